@@ -0,0 +1,177 @@
+/**
+ * @file bench.c
+ * @author amitfr1
+ * @brief Benchmark harness for the bit queue hot paths
+ *
+ * Sweeps bit_queue_read_bits/bit_queue_write_bits across bit widths, every bit_offset phase 0-7 and buffer
+ * sizes from L1 resident to DRAM resident, reporting ns/call and Gbit/s for each point. Use this yardstick to
+ * compare library versions before a rollout.
+ *
+ * @ingroup bit_queue
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bit_queue.h"
+
+/**
+ * @brief The time budget of one measured point in nanoseconds
+ */
+#define BENCH_BUDGET_NS 20000000LL
+
+/**
+ * @brief The warmup budget before each measured point in nanoseconds
+ */
+#define BENCH_WARMUP_NS 2000000LL
+
+/**
+ * @brief The bit widths that are swept
+ */
+static const unsigned bench_widths[] = {1, 2, 3, 4, 6, 7, 8, 12, 16, 24, 32, 48, 64};
+
+/**
+ * @brief The buffer sizes that are swept, L1 resident, cache resident and DRAM resident
+ */
+static const size_t bench_sizes[] = {16 * 1024, 1024 * 1024, 64 * 1024 * 1024};
+
+/**
+ * @brief This function reads the monotonic clock in nanoseconds
+ *
+ * @return long long The current time
+ */
+static long long bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief This function runs one read measurement point
+ *
+ * The queue is filled once, the post phase cursor state is marked and every drain pass is rewound in O(1), so
+ * the measured loop is only unchecked reads.
+ *
+ * @param bytes The queue buffer size
+ * @param width The read width in bits
+ * @param phase The bit_offset phase of the read cursor, 0 to 7
+ */
+static void bench_read_point(size_t bytes, unsigned width, unsigned phase)
+{
+    uint8_t scratch[16] = {0};
+    bit_queue_t * bq = bit_queue_base_init(bytes);
+    uint8_t * junk = malloc(bytes);
+    bit_queue_mark_t mark;
+    long long start, now, calls = 0;
+    int warm;
+    if (bq == NULL || junk == NULL)
+    {
+        fprintf(stderr, "allocation failed for %zu bytes\n", bytes);
+        exit(1);
+    }
+    for (size_t i = 0; i < bytes; i++)
+    {
+        junk[i] = (uint8_t)(i * 2654435761u);
+    }
+    bit_queue_write_bits(bq, junk, bytes * 8);
+    if (phase)
+    {
+        bit_queue_advance_bits(bq, phase);
+    }
+    bit_queue_mark(bq, &mark);
+    for (warm = 0; warm < 2; warm++)
+    {
+        start = bench_now_ns();
+        calls = 0;
+        do
+        {
+            while (bit_queue_has_data(bq, width))
+            {
+                bit_queue_read_bits_unchecked(bq, scratch, width);
+                calls++;
+            }
+            bit_queue_rewind(bq, &mark);
+            now = bench_now_ns();
+        } while (now - start < (warm ? BENCH_BUDGET_NS : BENCH_WARMUP_NS));
+    }
+    printf("read,%zu,%u,%u,%lld,%.1f,%.3f\n", bytes, width, phase, calls,
+           (double)(now - start) / calls, (double)calls * width / (now - start));
+    free(junk);
+    bit_queue_destroy(bq);
+}
+
+/**
+ * @brief This function runs one write measurement point
+ *
+ * The cursors are parked at the wanted phase, the state is marked and every fill pass is rewound in O(1), so
+ * the measured loop is only unchecked writes.
+ *
+ * @param bytes The queue buffer size
+ * @param width The write width in bits
+ * @param phase The bit_offset phase of the write cursor, 0 to 7
+ */
+static void bench_write_point(size_t bytes, unsigned width, unsigned phase)
+{
+    uint8_t scratch[16] = {0xa5, 0x5a, 0xa5, 0x5a, 0xa5, 0x5a, 0xa5, 0x5a};
+    bit_queue_t * bq = bit_queue_base_init(bytes);
+    bit_queue_mark_t mark;
+    long long start, now, calls = 0;
+    int warm;
+    if (bq == NULL)
+    {
+        fprintf(stderr, "allocation failed for %zu bytes\n", bytes);
+        exit(1);
+    }
+    if (phase)
+    {
+        bit_queue_write_bits(bq, scratch, phase);
+        bit_queue_advance_bits(bq, phase);
+    }
+    bit_queue_mark(bq, &mark);
+    for (warm = 0; warm < 2; warm++)
+    {
+        start = bench_now_ns();
+        calls = 0;
+        do
+        {
+            while (bit_queue_has_space(bq, width))
+            {
+                bit_queue_write_bits_unchecked(bq, scratch, width);
+                calls++;
+            }
+            bit_queue_rewind(bq, &mark);
+            now = bench_now_ns();
+        } while (now - start < (warm ? BENCH_BUDGET_NS : BENCH_WARMUP_NS));
+    }
+    printf("write,%zu,%u,%u,%lld,%.1f,%.3f\n", bytes, width, phase, calls,
+           (double)(now - start) / calls, (double)calls * width / (now - start));
+    bit_queue_destroy(bq);
+}
+
+int main(int argc, char **argv)
+{
+    size_t size_count = sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+    size_t width_count = sizeof(bench_widths) / sizeof(bench_widths[0]);
+    size_t s, w;
+    unsigned phase;
+    // a single optional argument limits the sweep to one buffer size in bytes
+    size_t only_size = (argc > 1) ? strtoull(argv[1], NULL, 0) : 0;
+    printf("op,buffer_bytes,width_bits,phase,calls,ns_per_call,gbit_per_s\n");
+    for (s = 0; s < size_count; s++)
+    {
+        if (only_size != 0 && bench_sizes[s] != only_size)
+        {
+            continue;
+        }
+        for (w = 0; w < width_count; w++)
+        {
+            for (phase = 0; phase < 8; phase++)
+            {
+                bench_read_point(bench_sizes[s], bench_widths[w], phase);
+                bench_write_point(bench_sizes[s], bench_widths[w], phase);
+            }
+        }
+    }
+    return 0;
+}
@@ -1,273 +1,2705 @@
-/**
- * @file bit_queue.c
- * @author amitfr1
- * @brief This is an adt for bit queuing
- * @version 0.1
- * @date 2021-12-11
- * 
- * @ingroup bit_queue
- * 
- */
-#include <stdlib.h>
-#include <errno.h>
-#include "bit_queue.h"
-
-/**
- * @brief The number of bits in a byte
- */
-#define BITS_IN_BYTE 8
-
-/**
- * @brief This is the mask of a byte
- */
-#define BYTE_MASK 0x000000ff
-
-/**
- * @brief This define calculates the mask its shifted the the end of the byte
- */ 
-#define CREATE_BYTE_MASK(bit_offset) ((BYTE_MASK << bit_offset) & BYTE_MASK)
-/**
- * @brief This define calculates the mask and it starts from the LSB
- */
-#define CREATE_BYTE_MASK_LSB(bit_offset) (CREATE_BYTE_MASK(bit_offset) >> bit_offset)
-
-/**
- * @brief This stuct holds all the fields used in the bit queue
- */
-struct _bit_queue_t
-{
-    uint8_t * buffer; /// The buffer that holds all of the data
-    uint8_t bit_offset; /// An index used to follow the bit progression in a byte
-    size_t byte_offset; /// An index used to follow byte progression
-    size_t written_bits; /// The number of bits that hold data in the buffer
-    size_t buffer_size; /// The buffer size in bits
-    bool free_buff;
-};
-
-/**
- * @brief This function checks if there is enough space to write all of the bits
- * 
- * Sets errno to EINVAL if bq = NULL
- * 
- * @param bq The bit queue
- * @param bit_count The number of bits we want to write
- * @return true if there is sufficient space in the queue false otherwise 
- */
-static bool bit_queue_has_space(bit_queue_t *bq, size_t bit_count);
-
-/**
- * @brief This function checks if there is enough data to read
- * 
- * Sets errno to EINVAL if bq = NULL
- * 
- * @param bq The bit queue
- * @param bit_count The number of bits we want to read
- * @return true if there is sufficient data in the queue false otherwise 
- */
-static bool bit_queue_has_data(bit_queue_t *bq, size_t bit_count);
-
-bit_queue_t * bit_queue_base_init(size_t byte_count)
-{
-    bit_queue_t * bq = NULL;
-    if (!byte_count)
-    {
-        errno = EINVAL;
-    }
-    else if (!(bq = calloc(1, sizeof(struct _bit_queue_t))))
-    {
-        // errno is set by calloc and bq = NULL
-    }
-    else if (!(bq->buffer = calloc(byte_count, sizeof(uint8_t))))
-    {
-        // errno is set by calloc and bq->buffer = NULL
-        free(bq);
-        bq = NULL;
-    }
-    else
-    {
-        bq->buffer_size = byte_count;
-        bq->written_bits = 0;
-        bq->free_buff = true;
-    }
-    return bq;
-}
-
-bit_queue_t * bit_queue_init(uint8_t * buffer, size_t byte_count, bool free_buff)
-{
-    bit_queue_t * bq = NULL;
-    if (!byte_count || buffer == NULL)
-    {
-        errno = EINVAL;
-    }
-    else if (!(bq = calloc(1, sizeof(struct _bit_queue_t))))
-    {
-        // errno is set by calloc and bq = NULL
-    }
-    else
-    {
-        bq->buffer = buffer;
-        bq->buffer_size = byte_count;
-        bq->written_bits = byte_count * BITS_IN_BYTE;
-        bq->free_buff = free_buff;
-    }
-    return bq;
-}
-
-int bit_queue_read_bits(bit_queue_t *bq, uint8_t *buffer, size_t bit_count)
-{
-    int ret_val = -1;
-    size_t offset_bit_count;
-    uint8_t b_bit_offset;
-    size_t b_byte_offset;
-    size_t r_bits, total_bits;
-    if (bq == NULL || buffer == NULL || bit_count == 0)
-    {
-        errno = EINVAL;
-    }
-    else if (bq->buffer == NULL)
-    {
-        errno = EINVAL;
-    }
-    else if (bit_count > bq->buffer_size * BITS_IN_BYTE)
-    {
-        errno = EMSGSIZE;
-    }
-    else if (!bit_queue_has_data(bq, bit_count))
-    {
-        // ret_val allready set
-        // !!! replace with a better errno
-        errno = EAGAIN;
-    }
-    else
-    {
-        // set bit counters to 0
-        b_bit_offset = 0;
-        b_byte_offset = 0;
-
-        // set our target bit count
-        r_bits = bit_count;
-        do
-        {
-            if (r_bits + b_bit_offset <= BITS_IN_BYTE && r_bits <= BITS_IN_BYTE - bq->bit_offset)
-            {
-                // we can read all the bits without needing to worry about crossing bytes
-                offset_bit_count = BITS_IN_BYTE - r_bits;
-            }
-            // will we cross the buffer 
-            else if (b_bit_offset >= bq->bit_offset)
-            {
-                // we will cross the buffer byte in the next copy
-                offset_bit_count = b_bit_offset;
-            }
-            else // b_bit_offset < bq->bit_offset
-            {
-                // we will cross the bit queue buffer byte in the next copy
-                offset_bit_count = bq->bit_offset;
-            }
-            // copy all the bits we can into the buffer
-            // because the buffer and the bq buffer can be on diffrent bit offsets we need to shift it back and forth
-            buffer[b_byte_offset] |= ((bq->buffer[bq->byte_offset] & (CREATE_BYTE_MASK_LSB(offset_bit_count) << bq->bit_offset)) >> bq->bit_offset) << b_bit_offset;
-
-            // update the bit counters
-            bq->bit_offset += (BITS_IN_BYTE - offset_bit_count);
-            b_byte_offset += (BITS_IN_BYTE - offset_bit_count);
-            r_bits -= (BITS_IN_BYTE - offset_bit_count);
-
-            // check if we are crossing bytes
-            if (bq->bit_offset == BITS_IN_BYTE)
-            {
-                bq->bit_offset = 0;
-                bq->byte_offset++;
-            }
-            if (b_bit_offset == BITS_IN_BYTE)
-            {
-                bq->bit_offset = 0;
-                b_byte_offset++;
-            }
-        } while (r_bits != 0);
-        // update the bit queue and the retval
-        bq->written_bits -= bit_count;
-        ret_val = bit_count;
-    }
-    return ret_val;
-}
-
-int bit_queue_write_bits(bit_queue_t *bq, uint8_t *buffer, size_t bit_count)
-{
-    int ret_val = -1;
-    if (bq == NULL || buffer == NULL || bit_count == 0)
-    {
-        errno = EINVAL;
-    }
-    else if (bq->buffer == NULL)
-    {
-        errno = EINVAL;
-    }
-    else if (bit_count > bq->buffer_size * BITS_IN_BYTE)
-    {
-        errno = EMSGSIZE;
-    }
-    else if (!bit_queue_has_space(bq, bit_count))
-    {
-        // ret_val allready set
-    }
-    else
-    {
-        // TODO: implement the write functionality
-    }
-    return ret_val;
-}
-
-int bit_queue_destroy(bit_queue_t *bq)
-{
-    int ret_val = -1;
-    if (bq == NULL)
-    {
-        errno = EINVAL;
-    }
-    else if (bq->buffer == NULL)
-    {
-        errno = EINVAL;
-    }
-    else
-    {
-        if (bq->free_buff)
-        {
-            free(bq->buffer);
-        }
-        bq->buffer = NULL;
-        free(bq);
-        ret_val = 0;
-    }
-    return ret_val;
-}
-
-// static functions
-
-static bool bit_queue_has_space(bit_queue_t *bq, size_t bit_count)
-{
-    bool ret_val = false;
-    if (bq == NULL)
-    {
-        errno = EINVAL;
-    }
-    else if ((bq->buffer_size * BITS_IN_BYTE) - bq->written_bits >= bit_count)
-    {
-        ret_val = true;
-    }
-    return ret_val;
-}
-
-static bool bit_queue_has_data(bit_queue_t *bq, size_t bit_count)
-{
-    bool ret_val = false;
-    if (bq == NULL)
-    {
-        errno = EINVAL;
-    }
-    else if (bq->written_bits >= bit_count)
-    {
-        ret_val = true;
-    }
-    return ret_val;
+/**
+ * @file bit_queue.c
+ * @author amitfr1
+ * @brief This is an adt for bit queuing
+ * @version 0.1
+ * @date 2021-12-11
+ * 
+ * @ingroup bit_queue
+ * 
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bit_queue.h"
+
+/**
+ * @brief The number of bits in a byte
+ */
+#define BITS_IN_BYTE 8
+
+/**
+ * @brief The number of bits in the word used by the bulk copy fast path
+ */
+#define BITS_IN_WORD 64
+
+/**
+ * @brief The fast path loads whole little endian words so it only runs on little endian hosts
+ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define BIT_QUEUE_WORD_FAST_PATH 1
+#else
+#define BIT_QUEUE_WORD_FAST_PATH 0
+#endif
+
+/**
+ * @brief This is the mask of a byte
+ */
+#define BYTE_MASK 0x000000ff
+
+/**
+ * @brief This define calculates the mask its shifted the the end of the byte
+ */ 
+#define CREATE_BYTE_MASK(bit_offset) ((BYTE_MASK << (bit_offset)) & BYTE_MASK)
+/**
+ * @brief This define calculates the mask and it starts from the LSB
+ */
+#define CREATE_BYTE_MASK_LSB(bit_offset) (CREATE_BYTE_MASK(bit_offset) >> (bit_offset))
+
+/**
+ * @brief This enum tells bit_queue_destroy how the buffer was obtained
+ */
+typedef enum
+{
+    BIT_QUEUE_BUF_NONE = 0, /// The buffer is owned by the caller and is left alone
+    BIT_QUEUE_BUF_HEAP, /// The buffer came from the allocator and is freed
+    BIT_QUEUE_BUF_MMAP, /// The buffer is a mapping of map_size bytes and is unmapped
+    BIT_QUEUE_BUF_SHM, /// The buffer and its control block are one shared mapping of map_size bytes
+} bit_queue_buf_ownership_t;
+
+/**
+ * @brief The cache line size used to separate the producer and consumer cursors
+ */
+#define BIT_QUEUE_CACHE_LINE 64
+
+/**
+ * @brief The set of flags the init functions accept, anything else is EINVAL
+ */
+#define BIT_QUEUE_FLAGS_VALID (BIT_QUEUE_FLAG_MSB_FIRST | BIT_QUEUE_FLAG_NOZERO | BIT_QUEUE_FLAG_LAZY | BIT_QUEUE_FLAG_HUGEPAGES)
+
+/**
+ * @brief The flags that steer the buffer allocation, meaningless when the caller brings the buffer
+ */
+#define BIT_QUEUE_FLAGS_ALLOC (BIT_QUEUE_FLAG_NOZERO | BIT_QUEUE_FLAG_LAZY | BIT_QUEUE_FLAG_HUGEPAGES)
+
+/**
+ * @brief The huge page size MAP_HUGETLB mappings are rounded up to
+ */
+#define BIT_QUEUE_HUGE_PAGE_SIZE (2u << 20)
+
+/**
+ * @brief These defines bump a stats counter, they compile away without BIT_QUEUE_STATS
+ */
+#ifdef BIT_QUEUE_STATS
+#define BIT_QUEUE_STAT_INC(bq, field) ((bq)->stats.field++)
+#define BIT_QUEUE_STAT_ADD(bq, field, n) ((bq)->stats.field += (n))
+#else
+#define BIT_QUEUE_STAT_INC(bq, field) ((void)0)
+#define BIT_QUEUE_STAT_ADD(bq, field, n) ((void)0)
+#endif
+
+/**
+ * @brief This define counts one successful operation at cursor with the given width
+ */
+#define BIT_QUEUE_STAT_OP(bq, cursor, bit_count, count_field, bits_field) \
+    do \
+    { \
+        BIT_QUEUE_STAT_INC(bq, count_field); \
+        BIT_QUEUE_STAT_ADD(bq, bits_field, bit_count); \
+        if (((cursor) % BITS_IN_BYTE) == 0 && ((bit_count) % BITS_IN_BYTE) == 0) \
+        { \
+            BIT_QUEUE_STAT_INC(bq, aligned_ops); \
+        } \
+        else \
+        { \
+            BIT_QUEUE_STAT_INC(bq, unaligned_ops); \
+        } \
+    } while (0)
+
+/**
+ * @brief The value a shared memory control block starts with, it spells BQSH
+ */
+#define BIT_QUEUE_SHM_MAGIC 0x42515348u
+
+/**
+ * @brief The control block at the start of a shared memory queue segment, the data bytes follow it
+ *
+ * Both processes map the same segment so the cursors here are the live cursors, the local handles only
+ * point at them. The magic is stored last with release ordering in create so attach never validates a
+ * half built block.
+ */
+typedef struct
+{
+    _Atomic uint32_t magic; /// BIT_QUEUE_SHM_MAGIC once the block is fully built
+    size_t byte_count; /// The queue buffer size in bytes, checked against the segment size in attach
+    /// The shared write cursor, same meaning as head_bits in the handle
+    _Atomic size_t head_bits __attribute__((aligned(BIT_QUEUE_CACHE_LINE)));
+    /// The shared read cursor, same meaning as tail_bits in the handle
+    _Atomic size_t tail_bits __attribute__((aligned(BIT_QUEUE_CACHE_LINE)));
+} bit_queue_shm_block_t;
+
+/**
+ * @brief One fixed size segment of a segmented queue, the payload bytes follow the header
+ */
+typedef struct _bit_queue_segment_t
+{
+    struct _bit_queue_segment_t * next; /// The next segment in the chain or NULL
+    uint8_t data[]; /// The payload, segment_bits / BITS_IN_BYTE bytes
+} bit_queue_segment_t;
+
+/**
+ * @brief This stuct holds all the fields used in the bit queue
+ *
+ * In spsc mode the producer only writes head_bits and the consumer only writes tail_bits, so the two cursors
+ * sit on their own cache lines and the shared fields above them stay read only after init.
+ */
+struct _bit_queue_t
+{
+    uint8_t * buffer; /// The buffer that holds all of the data
+    size_t buffer_size; /// The buffer size in bytes
+    size_t capacity_bits; /// The buffer size in bits
+    uint8_t buf_ownership; /// How the buffer is released in destroy, one of bit_queue_buf_ownership_t
+    size_t map_size; /// The length of the mapping when buf_ownership is BIT_QUEUE_BUF_MMAP
+    bool spsc; /// When set the cursors are accessed with acquire/release ordering
+    bool static_handle; /// When set the handle lives in caller owned storage and is never freed
+    bool msb_first; /// When set the copies and extractions use MSB first bit order inside each byte
+    bool segmented; /// When set the data lives in chained segments and buffer is NULL
+    size_t segment_bits; /// The payload size of one segment in bits
+    size_t seg_base_bits; /// The absolute bit index where seg_first starts
+    size_t seg_count; /// The amount of segments in the active chain
+    bit_queue_segment_t * seg_first; /// The segment holding the read cursor
+    bit_queue_segment_t * seg_last; /// The segment holding the write cursor
+    bit_queue_segment_t * seg_free; /// Freelist of drained segments waiting for reuse
+    bit_queue_refill_cb_t refill_cb; /// Pulled when a read finds too little data, NULL when unused
+    void * refill_ctx; /// Opaque pointer handed to refill_cb
+    bit_queue_shm_block_t * shm; /// The shared control block holding the live cursors, NULL for local queues
+    bool multi_consumer; /// When set consumers claim whole chunks with a CAS instead of using the read api
+    size_t chunk_bits; /// The claim granularity in bits
+    size_t chunk_count; /// The amount of chunks the buffer divides into
+    _Atomic uint8_t * chunk_done; /// One flag per ring chunk, set when the chunk was released
+    _Atomic bool reclaim_busy; /// Makes sure only one releaser sweeps the done flags at a time
+#ifdef BIT_QUEUE_STATS
+    bit_queue_stats_t stats; /// Hot path counters, only present in instrumented builds
+#endif
+    /// The total amount of bits ever written, the write cursor is head_bits % capacity_bits
+    _Atomic size_t head_bits __attribute__((aligned(BIT_QUEUE_CACHE_LINE)));
+    /// The total amount of bits ever read, the read cursor is tail_bits % capacity_bits
+    _Atomic size_t tail_bits __attribute__((aligned(BIT_QUEUE_CACHE_LINE)));
+    /// The total amount of bits ever claimed by consumers, only used in multi consumer mode
+    _Atomic size_t claim_bits __attribute__((aligned(BIT_QUEUE_CACHE_LINE)));
+};
+
+/**
+ * @brief This stuct holds a pool of pre allocated bit queue handles and their buffer slab
+ */
+struct _bit_queue_pool_t
+{
+    struct _bit_queue_t * handles; /// Array of count handles
+    uint8_t * slab; /// One contiguous allocation holding all the buffers
+    size_t * next; /// Freelist links by handle index
+    size_t free_head; /// Index of the first free handle or count when the pool is empty
+    size_t count; /// The amount of handles in the pool
+    size_t byte_count; /// The buffer size of each queue in bytes
+};
+
+// the opaque storage type in the header must be able to hold and align the real struct
+_Static_assert(sizeof(struct _bit_queue_t) <= BIT_QUEUE_STORAGE_SIZE, "bit_queue_storage_t is too small for struct _bit_queue_t");
+_Static_assert(_Alignof(struct _bit_queue_t) <= _Alignof(bit_queue_storage_t), "bit_queue_storage_t is under aligned for struct _bit_queue_t");
+
+/**
+ * @brief This function loads the write cursor, with acquire ordering in spsc mode
+ *
+ * @param bq The bit queue
+ * @return size_t The write cursor
+ */
+static inline size_t bit_queue_load_head(bit_queue_t *bq)
+{
+    _Atomic size_t * cursor = bq->shm ? &bq->shm->head_bits : &bq->head_bits;
+    return atomic_load_explicit(cursor, bq->spsc ? memory_order_acquire : memory_order_relaxed);
+}
+
+/**
+ * @brief This function loads the read cursor, with acquire ordering in spsc mode
+ *
+ * @param bq The bit queue
+ * @return size_t The read cursor
+ */
+static inline size_t bit_queue_load_tail(bit_queue_t *bq)
+{
+    _Atomic size_t * cursor = bq->shm ? &bq->shm->tail_bits : &bq->tail_bits;
+    return atomic_load_explicit(cursor, bq->spsc ? memory_order_acquire : memory_order_relaxed);
+}
+
+/**
+ * @brief This function publishes the write cursor, with release ordering in spsc mode
+ *
+ * @param bq The bit queue
+ * @param head_bits The new write cursor
+ */
+static inline void bit_queue_store_head(bit_queue_t *bq, size_t head_bits)
+{
+    _Atomic size_t * cursor = bq->shm ? &bq->shm->head_bits : &bq->head_bits;
+    atomic_store_explicit(cursor, head_bits, bq->spsc ? memory_order_release : memory_order_relaxed);
+}
+
+/**
+ * @brief This function publishes the read cursor, with release ordering in spsc mode
+ *
+ * @param bq The bit queue
+ * @param tail_bits The new read cursor
+ */
+static inline void bit_queue_store_tail(bit_queue_t *bq, size_t tail_bits)
+{
+    _Atomic size_t * cursor = bq->shm ? &bq->shm->tail_bits : &bq->tail_bits;
+    atomic_store_explicit(cursor, tail_bits, bq->spsc ? memory_order_release : memory_order_relaxed);
+}
+
+/**
+ * @brief This function checks for data like bit_queue_has_data but pulls the refill callback until there is enough
+ *
+ * @param bq The bit queue
+ * @param bit_count The number of bits we want to read
+ * @return true if there is sufficient data in the queue false otherwise
+ */
+static bool bit_queue_wait_data(bit_queue_t *bq, size_t bit_count)
+{
+    bool ret_val;
+    while (!(ret_val = bit_queue_has_data(bq, bit_count)))
+    {
+        if (bq->refill_cb == NULL || bq->refill_cb(bq, bq->refill_ctx) <= 0)
+        {
+            // no callback or no progress, give up and let the caller report EAGAIN
+            break;
+        }
+        BIT_QUEUE_STAT_INC(bq, refills);
+    }
+    return ret_val;
+}
+
+/**
+ * @brief This function copys bit_count bits from the src bit position into the dst bit position
+ *
+ * The bits are kept in LSB first order like the mask macros produce.
+ * Whole destination bytes are stored directly and partial edge bytes only change the copied bit positions.
+ * The bulk of the copy moves a whole word per iteration and the byte loop only handles the sub word head and tail.
+ *
+ * @param dst The destination buffer
+ * @param dst_pos The first destination bit index
+ * @param src The source buffer
+ * @param src_pos The first source bit index
+ * @param bit_count The amount of bits to copy
+ */
+static void bit_queue_copy_bits(uint8_t *dst, size_t dst_pos, const uint8_t *src, size_t src_pos, size_t bit_count);
+
+/**
+ * @brief This function is the MSB first twin of bit_queue_copy_bits
+ *
+ * Bit index i of a buffer is the physical bit 7 - i % 8 of byte i / 8, so the first bit of the stream is the
+ * most significant bit of the first byte. The structure mirrors the LSB kernel: a memcpy entry for byte
+ * aligned cursors, destination alignment, a bulk shift copy and a byte loop for the edges.
+ *
+ * @param dst The destination buffer
+ * @param dst_pos The first destination bit index
+ * @param src The source buffer
+ * @param src_pos The first source bit index
+ * @param bit_count The amount of bits to copy
+ */
+static void bit_queue_copy_bits_msb(uint8_t *dst, size_t dst_pos, const uint8_t *src, size_t src_pos, size_t bit_count);
+
+/**
+ * @brief This function copys whole bytes from a bit shifted source, dst[i] = src[i] >> shift merged with src[i + 1]
+ *
+ * This is the bulk kernel for reads and writes whose cursors sit at diffrent bit offsets. It reads byte_count + 1
+ * source bytes, which the callers guarantee to be in bounds. The body is vectorized with AVX2 (runtime detected)
+ * on x86 and NEON on ARM, with a word loop and a byte loop for the tail.
+ *
+ * @param dst The destination buffer, byte aligned
+ * @param src The first source byte
+ * @param shift The source bit offset, 1 to 7
+ * @param byte_count The amount of whole bytes to produce
+ */
+static void bit_queue_shift_copy(uint8_t *dst, const uint8_t *src, uint8_t shift, size_t byte_count);
+
+/**
+ * @brief This function is the MSB first twin of bit_queue_shift_copy, dst[i] = src[i] << shift merged with src[i + 1]
+ *
+ * The word loop byte swaps each load so the per byte left shift becomes one big endian word shift. The same
+ * bounds guarantee as the LSB kernel applies: byte_count + 1 source bytes are read and are in bounds.
+ *
+ * @param dst The destination buffer, byte aligned
+ * @param src The first source byte
+ * @param shift The source bit offset, 1 to 7
+ * @param byte_count The amount of whole bytes to produce
+ */
+static void bit_queue_shift_copy_msb(uint8_t *dst, const uint8_t *src, uint8_t shift, size_t byte_count);
+
+/**
+ * @brief This function picks the copy kernel that matches the queue's bit order
+ *
+ * @param msb_first Whether the MSB first kernel is wanted
+ * @param dst The destination buffer
+ * @param dst_pos The first destination bit index
+ * @param src The source buffer
+ * @param src_pos The first source bit index
+ * @param bit_count The amount of bits to copy
+ */
+static inline void bit_queue_copy_bits_mode(bool msb_first, uint8_t *dst, size_t dst_pos, const uint8_t *src, size_t src_pos, size_t bit_count)
+{
+    if (msb_first)
+    {
+        bit_queue_copy_bits_msb(dst, dst_pos, src, src_pos, bit_count);
+    }
+    else
+    {
+        bit_queue_copy_bits(dst, dst_pos, src, src_pos, bit_count);
+    }
+}
+
+/**
+ * @brief This function copys bits out of the ring buffer and splits the copy when it wraps at the buffer end
+ *
+ * @param bq The source bit queue
+ * @param dst The destination buffer
+ * @param dst_pos The first destination bit index
+ * @param src_cursor The absolute source cursor, usually tail_bits
+ * @param bit_count The amount of bits to copy
+ */
+static void bit_queue_copy_out(bit_queue_t *bq, uint8_t *dst, size_t dst_pos, size_t src_cursor, size_t bit_count);
+
+/**
+ * @brief This function copys bits into the ring buffer and splits the copy when it wraps at the buffer end
+ *
+ * @param bq The destination bit queue
+ * @param dst_cursor The absolute destination cursor, usually head_bits
+ * @param src The source buffer
+ * @param src_pos The first source bit index
+ * @param bit_count The amount of bits to copy
+ */
+static void bit_queue_copy_in(bit_queue_t *bq, size_t dst_cursor, const uint8_t *src, size_t src_pos, size_t bit_count);
+
+/**
+ * @brief This function extracts up to a word of bits at the given cursor as a value
+ *
+ * The first bit of the stream lands in bit 0 of the value. On little endian hosts the common case is a single
+ * word load, shift and mask; near the buffer end or across the wrap it falls back to the copy helpers.
+ *
+ * @param bq The bit queue
+ * @param cursor The absolute cursor to extract from
+ * @param width The amount of bits to extract, 1 to 64
+ * @return uint64_t The extracted value
+ */
+static uint64_t bit_queue_extract_value(bit_queue_t *bq, size_t cursor, unsigned width);
+
+/**
+ * @brief This function is the MSB first twin of bit_queue_extract_value
+ *
+ * The first bit of the stream lands in the top bit of the width sized field, so the value is allready in wire
+ * order. The common case is one byte swapped word load, shift and mask.
+ *
+ * @param bq The bit queue
+ * @param cursor The absolute cursor to extract from
+ * @param width The amount of bits to extract, 1 to 64
+ * @return uint64_t The extracted value
+ */
+static uint64_t bit_queue_extract_value_msb(bit_queue_t *bq, size_t cursor, unsigned width);
+
+/**
+ * @brief This function extracts a value with the kernel that matches the queue's bit order
+ *
+ * @param bq The bit queue
+ * @param cursor The absolute cursor to extract from
+ * @param width The amount of bits to extract, 1 to 64
+ * @return uint64_t The extracted value
+ */
+static uint64_t bit_queue_extract_mode(bit_queue_t *bq, size_t cursor, unsigned width);
+
+/**
+ * @brief This function measures the run of bits before the next bit with the stop value, consuming nothing
+ *
+ * The run is resolved a word at a time with a count zeros instruction, pulling the refill callback when the
+ * queued data runs out before a stop bit was found.
+ *
+ * Sets errno to EAGAIN when no stop bit is within the queued data.
+ *
+ * @param bq The bit queue
+ * @param stop_value The bit value that ends the run
+ * @param run Out parameter that receives the length of the run
+ * @return int 0 in success or -1 in failure
+ */
+static int bit_queue_scan_run(bit_queue_t *bq, bool stop_value, size_t *run);
+
+/**
+ * @brief This function does the shared validation and extraction for the typed readers
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or bq->buffer = NULL or width = 0 or width > max_width
+ * 2) Sets errno to EAGAIN if there isn't enough data in the queue
+ *
+ * @param bq The bit queue
+ * @param width The amount of bits to read
+ * @param max_width The bit size of the destination type
+ * @param value Out parameter for the extracted value
+ * @return int 0 in success or -1 in failure
+ */
+static int bit_queue_read_value(bit_queue_t *bq, unsigned width, unsigned max_width, uint64_t *value);
+
+/**
+ * @brief This function makes sure the segment chain has room for bit_count more bits past the write cursor
+ *
+ * Segments are appended from the freelist first and the allocator second. A failed allocation leaves the
+ * queued data untouched, so a write can reserve all its room up front and then copy without a failure path.
+ *
+ * The errno is set by the allocation method.
+ *
+ * @param bq The segmented bit queue
+ * @param bit_count The amount of bits about to be written
+ * @return int 0 in success or -1 in failure
+ */
+static int bit_queue_seg_reserve(bit_queue_t *bq, size_t bit_count);
+
+/**
+ * @brief This function copys bits out of the segment chain, walking segments as the span crosses them
+ *
+ * @param bq The segmented bit queue
+ * @param dst The destination buffer
+ * @param src_cursor The absolute source cursor, at or past seg_base_bits
+ * @param bit_count The amount of bits to copy
+ */
+static void bit_queue_seg_copy_out(bit_queue_t *bq, uint8_t *dst, size_t src_cursor, size_t bit_count);
+
+/**
+ * @brief This function copys bits into the segment chain, the room must have been reserved allready
+ *
+ * @param bq The segmented bit queue
+ * @param dst_cursor The absolute destination cursor, usually head_bits
+ * @param src The source buffer
+ * @param bit_count The amount of bits to copy
+ */
+static void bit_queue_seg_copy_in(bit_queue_t *bq, size_t dst_cursor, const uint8_t *src, size_t bit_count);
+
+/**
+ * @brief This function pushes the fully drained leading segments onto the freelist
+ *
+ * The last segment is never released, the write cursor lives there.
+ *
+ * @param bq The segmented bit queue
+ */
+static void bit_queue_seg_release(bit_queue_t *bq);
+
+bit_queue_t * bit_queue_base_init(size_t byte_count)
+{
+    return bit_queue_base_init_ex(byte_count, 0);
+}
+
+/**
+ * @brief This function obtains the data buffer the way the allocation flags ask for
+ *
+ * The errno is set by the failed allocation method.
+ *
+ * @param bq The bit queue whose buffer, ownership and map_size are filled
+ * @param byte_count The buffer size in bytes
+ * @param flags The init flags
+ * @return int 0 in success or -1 in failure
+ */
+static int bit_queue_alloc_buffer(bit_queue_t *bq, size_t byte_count, unsigned flags)
+{
+    int ret_val = 0;
+    uint8_t * map = MAP_FAILED;
+    size_t map_size = byte_count;
+    int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (flags & BIT_QUEUE_FLAG_LAZY)
+    {
+        // the kernel faults the pages in zeroed only as the write cursor reaches them
+        mmap_flags |= MAP_NORESERVE;
+    }
+    if (flags & BIT_QUEUE_FLAG_HUGEPAGES)
+    {
+        // MAP_HUGETLB wants a length in whole huge pages, only the mapping is rounded, the queue keeps its size
+        map_size = (byte_count + BIT_QUEUE_HUGE_PAGE_SIZE - 1) & ~(size_t)(BIT_QUEUE_HUGE_PAGE_SIZE - 1);
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+        // prefault the huge pages right here, an unbacked hugetlb mapping would SIGBUS on first touch instead
+        // of failing, and a failed mmap lets the fallback below kick in
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                   (mmap_flags & ~MAP_NORESERVE) | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+#endif
+        if (map == MAP_FAILED)
+        {
+            // no reserved huge pages on this host, take a plain mapping and ask for transparent huge pages
+            map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
+#ifdef MADV_HUGEPAGE
+            if (map != MAP_FAILED)
+            {
+                madvise(map, map_size, MADV_HUGEPAGE);
+            }
+#endif
+        }
+    }
+    else if (flags & BIT_QUEUE_FLAG_LAZY)
+    {
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, mmap_flags, -1, 0);
+    }
+    if (flags & (BIT_QUEUE_FLAG_LAZY | BIT_QUEUE_FLAG_HUGEPAGES))
+    {
+        if (map == MAP_FAILED)
+        {
+            // errno is set by mmap
+            ret_val = -1;
+        }
+        else
+        {
+            bq->buffer = map;
+            bq->buf_ownership = BIT_QUEUE_BUF_MMAP;
+            bq->map_size = map_size;
+        }
+    }
+    else if (flags & BIT_QUEUE_FLAG_NOZERO)
+    {
+        // the cursors allready bound the valid region so zeroing every page up front is wasted cold start time
+        if (!(bq->buffer = malloc(byte_count)))
+        {
+            // errno is set by malloc
+            ret_val = -1;
+        }
+        else
+        {
+            bq->buf_ownership = BIT_QUEUE_BUF_HEAP;
+        }
+    }
+    else if (!(bq->buffer = calloc(byte_count, sizeof(uint8_t))))
+    {
+        // errno is set by calloc
+        ret_val = -1;
+    }
+    else
+    {
+        bq->buf_ownership = BIT_QUEUE_BUF_HEAP;
+    }
+    return ret_val;
+}
+
+bit_queue_t * bit_queue_base_init_ex(size_t byte_count, unsigned flags)
+{
+    bit_queue_t * bq = NULL;
+    if (!byte_count || (flags & ~BIT_QUEUE_FLAGS_VALID) != 0)
+    {
+        errno = EINVAL;
+    }
+    else if (!(bq = calloc(1, sizeof(struct _bit_queue_t))))
+    {
+        // errno is set by calloc and bq = NULL
+    }
+    else if (bit_queue_alloc_buffer(bq, byte_count, flags) != 0)
+    {
+        // errno is set by the allocation method
+        free(bq);
+        bq = NULL;
+    }
+    else
+    {
+        bq->buffer_size = byte_count;
+        bq->capacity_bits = byte_count * BITS_IN_BYTE;
+        bq->msb_first = (flags & BIT_QUEUE_FLAG_MSB_FIRST) != 0;
+    }
+    return bq;
+}
+
+bit_queue_t * bit_queue_init(uint8_t * buffer, size_t byte_count, bool free_buff)
+{
+    return bit_queue_init_ex(buffer, byte_count, free_buff, 0);
+}
+
+bit_queue_t * bit_queue_init_ex(uint8_t * buffer, size_t byte_count, bool free_buff, unsigned flags)
+{
+    bit_queue_t * bq = NULL;
+    if (!byte_count || buffer == NULL || (flags & ~BIT_QUEUE_FLAGS_VALID) != 0 || (flags & BIT_QUEUE_FLAGS_ALLOC) != 0)
+    {
+        // the allocation flags make no sense here, the caller allready brings the buffer
+        errno = EINVAL;
+    }
+    else if (!(bq = calloc(1, sizeof(struct _bit_queue_t))))
+    {
+        // errno is set by calloc and bq = NULL
+    }
+    else
+    {
+        bq->buffer = buffer;
+        bq->buffer_size = byte_count;
+        bq->capacity_bits = byte_count * BITS_IN_BYTE;
+        atomic_init(&bq->head_bits, bq->capacity_bits);
+        bq->buf_ownership = free_buff ? BIT_QUEUE_BUF_HEAP : BIT_QUEUE_BUF_NONE;
+        bq->msb_first = (flags & BIT_QUEUE_FLAG_MSB_FIRST) != 0;
+    }
+    return bq;
+}
+
+bit_queue_t * bit_queue_init_static(bit_queue_storage_t *storage, uint8_t *buffer, size_t byte_count, bool full)
+{
+    bit_queue_t * bq = NULL;
+    if (storage == NULL || buffer == NULL || !byte_count)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        memset(storage, 0, sizeof(*storage));
+        bq = (bit_queue_t *)storage;
+        bq->buffer = buffer;
+        bq->buffer_size = byte_count;
+        bq->capacity_bits = byte_count * BITS_IN_BYTE;
+        bq->static_handle = true;
+        if (full)
+        {
+            atomic_init(&bq->head_bits, bq->capacity_bits);
+        }
+    }
+    return bq;
+}
+
+bit_queue_t * bit_queue_mmap_init(const char *path)
+{
+    bit_queue_t * bq = NULL;
+    struct stat st;
+    uint8_t * map = MAP_FAILED;
+    int fd = -1;
+    if (path == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if ((fd = open(path, O_RDONLY)) < 0)
+    {
+        // errno is set by open
+    }
+    else if (fstat(fd, &st) != 0)
+    {
+        // errno is set by fstat
+    }
+    else if (st.st_size == 0)
+    {
+        errno = EINVAL;
+    }
+    else if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        // errno is set by mmap
+    }
+    else if (!(bq = calloc(1, sizeof(struct _bit_queue_t))))
+    {
+        // errno is set by calloc and bq = NULL
+        munmap(map, st.st_size);
+    }
+    else
+    {
+        // the replay access pattern is a forward scan so tell the kernel to read ahead
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        bq->buffer = map;
+        bq->buffer_size = st.st_size;
+        bq->capacity_bits = (size_t)st.st_size * BITS_IN_BYTE;
+        atomic_init(&bq->head_bits, bq->capacity_bits);
+        bq->buf_ownership = BIT_QUEUE_BUF_MMAP;
+        bq->map_size = st.st_size;
+    }
+    if (fd >= 0)
+    {
+        // the mapping keeps the file alive on its own
+        close(fd);
+    }
+    return bq;
+}
+
+/**
+ * @brief This function builds a local handle over a mapped shared memory control block
+ *
+ * The errno is set by calloc.
+ *
+ * @param block The mapped control block
+ * @param byte_count The queue buffer size in bytes
+ * @param map_size The full segment size in bytes
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+static bit_queue_t * bit_queue_shm_setup(bit_queue_shm_block_t *block, size_t byte_count, size_t map_size)
+{
+    bit_queue_t * bq = calloc(1, sizeof(struct _bit_queue_t));
+    if (bq != NULL)
+    {
+        bq->shm = block;
+        bq->buffer = (uint8_t *)(block + 1);
+        bq->buffer_size = byte_count;
+        bq->capacity_bits = byte_count * BITS_IN_BYTE;
+        bq->buf_ownership = BIT_QUEUE_BUF_SHM;
+        bq->map_size = map_size;
+        // the producer and the consumer live in diffrent processes so the cursors need the spsc ordering
+        bq->spsc = true;
+    }
+    return bq;
+}
+
+bit_queue_t * bit_queue_shm_create(const char *name, size_t byte_count)
+{
+    bit_queue_t * bq = NULL;
+    bit_queue_shm_block_t * block = MAP_FAILED;
+    size_t map_size = sizeof(bit_queue_shm_block_t) + byte_count;
+    int fd = -1;
+    if (name == NULL || !byte_count)
+    {
+        errno = EINVAL;
+    }
+    else if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600)) < 0)
+    {
+        // errno is set by shm_open
+    }
+    else if (ftruncate(fd, (off_t)map_size) != 0)
+    {
+        // errno is set by ftruncate
+        shm_unlink(name);
+    }
+    else if ((block = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        // errno is set by mmap
+        shm_unlink(name);
+    }
+    else if (!(bq = bit_queue_shm_setup(block, byte_count, map_size)))
+    {
+        // errno is set by calloc and bq = NULL
+        munmap(block, map_size);
+        shm_unlink(name);
+    }
+    else
+    {
+        // the pages come zeroed from ftruncate but spell the cursors out anyway
+        atomic_init(&block->head_bits, 0);
+        atomic_init(&block->tail_bits, 0);
+        block->byte_count = byte_count;
+        atomic_store_explicit(&block->magic, BIT_QUEUE_SHM_MAGIC, memory_order_release);
+    }
+    if (fd >= 0)
+    {
+        // the mapping keeps the segment alive on its own
+        close(fd);
+    }
+    return bq;
+}
+
+bit_queue_t * bit_queue_shm_attach(const char *name)
+{
+    bit_queue_t * bq = NULL;
+    bit_queue_shm_block_t * block = MAP_FAILED;
+    struct stat st;
+    int fd = -1;
+    if (name == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if ((fd = shm_open(name, O_RDWR, 0)) < 0)
+    {
+        // errno is set by shm_open
+    }
+    else if (fstat(fd, &st) != 0)
+    {
+        // errno is set by fstat
+    }
+    else if ((size_t)st.st_size < sizeof(bit_queue_shm_block_t))
+    {
+        errno = EPROTO;
+    }
+    else if ((block = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        // errno is set by mmap
+    }
+    else if (atomic_load_explicit(&block->magic, memory_order_acquire) != BIT_QUEUE_SHM_MAGIC ||
+             block->byte_count != (size_t)st.st_size - sizeof(bit_queue_shm_block_t))
+    {
+        // not a bit queue segment, or not one that finished building
+        errno = EPROTO;
+        munmap(block, st.st_size);
+    }
+    else if (!(bq = bit_queue_shm_setup(block, block->byte_count, st.st_size)))
+    {
+        // errno is set by calloc and bq = NULL
+        munmap(block, st.st_size);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return bq;
+}
+
+int bit_queue_shm_unlink(const char *name)
+{
+    int ret_val = -1;
+    if (name == NULL)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        ret_val = shm_unlink(name);
+    }
+    return ret_val;
+}
+
+bit_queue_t * bit_queue_spsc_init(size_t byte_count)
+{
+    bit_queue_t * bq = bit_queue_base_init(byte_count);
+    if (bq != NULL)
+    {
+        bq->spsc = true;
+    }
+    return bq;
+}
+
+bit_queue_t * bit_queue_mc_init(size_t byte_count, size_t chunk_bytes)
+{
+    bit_queue_t * bq = NULL;
+    if (!byte_count || !chunk_bytes || (byte_count % chunk_bytes) != 0)
+    {
+        // the capacity must divide into whole chunks so a claimed chunk never wraps at the buffer end
+        errno = EINVAL;
+    }
+    else if ((bq = bit_queue_base_init(byte_count)) == NULL)
+    {
+        // errno is set by the allocation method and bq = NULL
+    }
+    else if (!(bq->chunk_done = calloc(byte_count / chunk_bytes, sizeof(*bq->chunk_done))))
+    {
+        // errno is set by calloc
+        bit_queue_destroy(bq);
+        bq = NULL;
+    }
+    else
+    {
+        bq->multi_consumer = true;
+        bq->chunk_bits = chunk_bytes * BITS_IN_BYTE;
+        bq->chunk_count = byte_count / chunk_bytes;
+        // the producer publishes and the consumers observe across threads, same discipline as spsc
+        bq->spsc = true;
+    }
+    return bq;
+}
+
+int bit_queue_chunk_claim(bit_queue_t *bq, bit_queue_chunk_t *chunk)
+{
+    int ret_val = -1;
+    size_t claim;
+    bool won = false;
+    if (bq == NULL || chunk == NULL || !bq->multi_consumer)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        // grab the next whole chunk with one CAS, losing just means another worker took it and we retry on
+        // the next one, there is no lock to sit behind
+        claim = atomic_load_explicit(&bq->claim_bits, memory_order_relaxed);
+        while (!won && bit_queue_load_head(bq) - claim >= bq->chunk_bits)
+        {
+            won = atomic_compare_exchange_weak_explicit(&bq->claim_bits, &claim, claim + bq->chunk_bits,
+                                                        memory_order_acq_rel, memory_order_relaxed);
+        }
+        if (!won)
+        {
+            // ret_val allready set
+            BIT_QUEUE_STAT_INC(bq, eagain);
+            errno = EAGAIN;
+        }
+        else
+        {
+            chunk->data = bq->buffer + (claim % bq->capacity_bits) / BITS_IN_BYTE;
+            chunk->byte_count = bq->chunk_bits / BITS_IN_BYTE;
+            chunk->chunk_index = claim / bq->chunk_bits;
+            BIT_QUEUE_STAT_OP(bq, claim, bq->chunk_bits, reads, bits_read);
+            ret_val = 0;
+        }
+    }
+    return ret_val;
+}
+
+int bit_queue_chunk_release(bit_queue_t *bq, bit_queue_chunk_t *chunk)
+{
+    int ret_val = -1;
+    size_t tail_bits;
+    bool busy;
+    if (bq == NULL || chunk == NULL || !bq->multi_consumer)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        atomic_store_explicit(&bq->chunk_done[chunk->chunk_index % bq->chunk_count], 1, memory_order_seq_cst);
+        // one releaser at a time sweeps the contiguous run of done chunks back to the producer, everyone
+        // re checks after the sweeper finishes, the seq_cst pairing of the flags and the busy bit makes
+        // sure a flag set while someone else was sweeping is never stranded
+        while (atomic_load_explicit(&bq->chunk_done[(bit_queue_load_tail(bq) / bq->chunk_bits) % bq->chunk_count],
+                                    memory_order_seq_cst) != 0)
+        {
+            busy = atomic_exchange_explicit(&bq->reclaim_busy, true, memory_order_seq_cst);
+            if (busy)
+            {
+                // another releaser is sweeping and is guaranteed to observe our flag after it is done
+                break;
+            }
+            tail_bits = bit_queue_load_tail(bq);
+            while (atomic_load_explicit(&bq->chunk_done[(tail_bits / bq->chunk_bits) % bq->chunk_count],
+                                        memory_order_seq_cst) != 0)
+            {
+                atomic_store_explicit(&bq->chunk_done[(tail_bits / bq->chunk_bits) % bq->chunk_count], 0,
+                                      memory_order_relaxed);
+                tail_bits += bq->chunk_bits;
+            }
+            bit_queue_store_tail(bq, tail_bits);
+            atomic_store_explicit(&bq->reclaim_busy, false, memory_order_seq_cst);
+        }
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+bit_queue_t * bit_queue_segmented_init(size_t segment_bytes)
+{
+    bit_queue_t * bq = NULL;
+    bit_queue_segment_t * seg = NULL;
+    if (!segment_bytes)
+    {
+        errno = EINVAL;
+    }
+    else if (!(bq = calloc(1, sizeof(struct _bit_queue_t))))
+    {
+        // errno is set by calloc and bq = NULL
+    }
+    else if (!(seg = malloc(sizeof(bit_queue_segment_t) + segment_bytes)))
+    {
+        // errno is set by malloc, the payload is left uninitialized on purpose, only written bits are read back
+        free(bq);
+        bq = NULL;
+    }
+    else
+    {
+        seg->next = NULL;
+        bq->segmented = true;
+        bq->segment_bits = segment_bytes * BITS_IN_BYTE;
+        bq->seg_first = seg;
+        bq->seg_last = seg;
+        bq->seg_count = 1;
+    }
+    return bq;
+}
+
+int bit_queue_set_refill(bit_queue_t *bq, bit_queue_refill_cb_t callback, void *ctx)
+{
+    int ret_val = -1;
+    if (bq == NULL)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        bq->refill_cb = callback;
+        bq->refill_ctx = ctx;
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+bit_queue_pool_t * bit_queue_pool_create(size_t count, size_t byte_count)
+{
+    bit_queue_pool_t * pool = NULL;
+    size_t i;
+    if (count == 0 || byte_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (!(pool = calloc(1, sizeof(struct _bit_queue_pool_t))))
+    {
+        // errno is set by calloc and pool = NULL
+    }
+    else
+    {
+        // sizeof(struct _bit_queue_t) is a multiple of the cache line so aligned_alloc accepts the size
+        pool->handles = aligned_alloc(BIT_QUEUE_CACHE_LINE, count * sizeof(struct _bit_queue_t));
+        pool->slab = calloc(count, byte_count);
+        pool->next = malloc(count * sizeof(size_t));
+        if (pool->handles == NULL || pool->slab == NULL || pool->next == NULL)
+        {
+            // errno is set by the failed allocation
+            bit_queue_pool_destroy(pool);
+            pool = NULL;
+        }
+        else
+        {
+            pool->count = count;
+            pool->byte_count = byte_count;
+            pool->free_head = 0;
+            for (i = 0; i < count; i++)
+            {
+                pool->next[i] = i + 1;
+            }
+        }
+    }
+    return pool;
+}
+
+bit_queue_t * bit_queue_pool_acquire(bit_queue_pool_t *pool)
+{
+    bit_queue_t * bq = NULL;
+    size_t idx;
+    if (pool == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (pool->free_head == pool->count)
+    {
+        errno = EAGAIN;
+    }
+    else
+    {
+        // pop the first free handle and point it into the slab
+        idx = pool->free_head;
+        pool->free_head = pool->next[idx];
+        bq = &pool->handles[idx];
+        memset(bq, 0, sizeof(*bq));
+        bq->buffer = pool->slab + (idx * pool->byte_count);
+        bq->buffer_size = pool->byte_count;
+        bq->capacity_bits = pool->byte_count * BITS_IN_BYTE;
+        bq->static_handle = true;
+    }
+    return bq;
+}
+
+int bit_queue_pool_release(bit_queue_pool_t *pool, bit_queue_t *bq)
+{
+    int ret_val = -1;
+    size_t idx;
+    if (pool == NULL || bq == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq < pool->handles || bq >= pool->handles + pool->count)
+    {
+        // the handle does not belong to this pool
+        errno = EINVAL;
+    }
+    else
+    {
+        // push the handle back on the freelist
+        idx = bq - pool->handles;
+        bq->buffer = NULL;
+        pool->next[idx] = pool->free_head;
+        pool->free_head = idx;
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+int bit_queue_pool_destroy(bit_queue_pool_t *pool)
+{
+    int ret_val = -1;
+    if (pool == NULL)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        free(pool->handles);
+        free(pool->slab);
+        free(pool->next);
+        free(pool);
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+int bit_queue_read_bits(bit_queue_t *bq, uint8_t *buffer, size_t bit_count)
+{
+    int ret_val = -1;
+    size_t tail_bits;
+    if (bq == NULL || buffer == NULL || bit_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL && !bq->segmented)
+    {
+        errno = EINVAL;
+    }
+    else if (!bq->segmented && bit_count > bq->capacity_bits)
+    {
+        BIT_QUEUE_STAT_INC(bq, emsgsize);
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_wait_data(bq, bit_count))
+    {
+        // ret_val allready set
+        // !!! replace with a better errno
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else if (bq->segmented)
+    {
+        // copy out of the segment chain and push the drained segments onto the freelist
+        tail_bits = bit_queue_load_tail(bq);
+        bit_queue_seg_copy_out(bq, buffer, tail_bits, bit_count);
+        bit_queue_store_tail(bq, tail_bits + bit_count);
+        bit_queue_seg_release(bq);
+        BIT_QUEUE_STAT_OP(bq, tail_bits, bit_count, reads, bits_read);
+        ret_val = bit_count;
+    }
+    else
+    {
+        // copy the bits out in bulk and publish the new read cursor
+        tail_bits = bit_queue_load_tail(bq);
+        bit_queue_copy_out(bq, buffer, 0, tail_bits, bit_count);
+        bit_queue_store_tail(bq, tail_bits + bit_count);
+        BIT_QUEUE_STAT_OP(bq, tail_bits, bit_count, reads, bits_read);
+        ret_val = bit_count;
+    }
+    return ret_val;
+}
+
+int bit_queue_write_bits(bit_queue_t *bq, uint8_t *buffer, size_t bit_count)
+{
+    int ret_val = -1;
+    size_t head_bits;
+    if (bq == NULL || buffer == NULL || bit_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL && !bq->segmented)
+    {
+        errno = EINVAL;
+    }
+    else if (!bq->segmented && bit_count > bq->capacity_bits)
+    {
+        BIT_QUEUE_STAT_INC(bq, emsgsize);
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_has_space(bq, bit_count))
+    {
+        // ret_val allready set
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else if (bq->segmented)
+    {
+        // reserve the room up front so a failed growth changes nothing, then copy into the chain
+        if (bit_queue_seg_reserve(bq, bit_count) == 0)
+        {
+            head_bits = bit_queue_load_head(bq);
+            bit_queue_seg_copy_in(bq, head_bits, buffer, bit_count);
+            bit_queue_store_head(bq, head_bits + bit_count);
+            BIT_QUEUE_STAT_OP(bq, head_bits, bit_count, writes, bits_written);
+            ret_val = bit_count;
+        }
+    }
+    else
+    {
+        // copy the bits in bulk after the last written bit and publish the new write cursor
+        head_bits = bit_queue_load_head(bq);
+        bit_queue_copy_in(bq, head_bits, buffer, 0, bit_count);
+        bit_queue_store_head(bq, head_bits + bit_count);
+        BIT_QUEUE_STAT_OP(bq, head_bits, bit_count, writes, bits_written);
+        ret_val = bit_count;
+    }
+    return ret_val;
+}
+
+int bit_queue_read_bits_unchecked(bit_queue_t *bq, uint8_t *buffer, size_t bit_count)
+{
+    // no validation here, the caller allready established the queue and the data
+    size_t tail_bits = bit_queue_load_tail(bq);
+    bit_queue_copy_out(bq, buffer, 0, tail_bits, bit_count);
+    bit_queue_store_tail(bq, tail_bits + bit_count);
+    BIT_QUEUE_STAT_OP(bq, tail_bits, bit_count, reads, bits_read);
+    return bit_count;
+}
+
+int bit_queue_write_bits_unchecked(bit_queue_t *bq, uint8_t *buffer, size_t bit_count)
+{
+    // no validation here, the caller allready established the queue and the space
+    size_t head_bits = bit_queue_load_head(bq);
+    bit_queue_copy_in(bq, head_bits, buffer, 0, bit_count);
+    bit_queue_store_head(bq, head_bits + bit_count);
+    BIT_QUEUE_STAT_OP(bq, head_bits, bit_count, writes, bits_written);
+    return bit_count;
+}
+
+int bit_queue_read_bits_multi(bit_queue_t **queues, bit_queue_request_t *reqs, size_t count)
+{
+    int ret_val = -1;
+    size_t i;
+    bit_queue_t * next;
+    if (queues == NULL || reqs == NULL || count == 0)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        ret_val = 0;
+        for (i = 0; i < count; i++)
+        {
+            if (i + 2 < count && queues[i + 2] != NULL)
+            {
+                // pull the handle two queues ahead, both the read only line and the consumer cursor line
+                __builtin_prefetch(queues[i + 2], 0, 3);
+                __builtin_prefetch((const uint8_t *)queues[i + 2] + offsetof(struct _bit_queue_t, tail_bits), 0, 3);
+            }
+            next = (i + 1 < count) ? queues[i + 1] : NULL;
+            if (next != NULL && next->buffer != NULL)
+            {
+                // the next handle was prefetched a lap ago so chasing its buffer pointer is cheap now
+                __builtin_prefetch(next->buffer + (bit_queue_load_tail(next) % next->capacity_bits) / BITS_IN_BYTE, 0, 3);
+            }
+            reqs[i].result = bit_queue_read_bits(queues[i], reqs[i].buffer, reqs[i].bit_count);
+            if (reqs[i].result >= 0)
+            {
+                ret_val++;
+            }
+        }
+    }
+    return ret_val;
+}
+
+bool bit_queue_has_space(bit_queue_t *bq, size_t bit_count)
+{
+    bool ret_val = false;
+    if (bq == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->segmented)
+    {
+        // the chain grows on demand so space is never the limit, only the allocator is
+        ret_val = true;
+    }
+    else if (bq->capacity_bits - (bit_queue_load_head(bq) - bit_queue_load_tail(bq)) >= bit_count)
+    {
+        ret_val = true;
+    }
+    return ret_val;
+}
+
+bool bit_queue_has_data(bit_queue_t *bq, size_t bit_count)
+{
+    bool ret_val = false;
+    if (bq == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_queue_load_head(bq) - bit_queue_load_tail(bq) >= bit_count)
+    {
+        ret_val = true;
+    }
+    return ret_val;
+}
+
+/**
+ * @brief This function validates an iovec array and sums the field widths
+ *
+ * Sets errno to EINVAL on a bad descriptor, see bit_queue_readv_bits.
+ *
+ * @param iov The array of field descriptors
+ * @param iov_count The amount of fields
+ * @param total_bits Out parameter for the total width
+ * @return int 0 in success or -1 in failure
+ */
+static int bit_queue_iovec_total(const bit_queue_iovec_t *iov, size_t iov_count, size_t *total_bits)
+{
+    int ret_val = 0;
+    size_t total = 0;
+    size_t i;
+    for (i = 0; i < iov_count && ret_val == 0; i++)
+    {
+        if (iov[i].buffer == NULL || iov[i].bit_count == 0)
+        {
+            errno = EINVAL;
+            ret_val = -1;
+        }
+        else
+        {
+            total += iov[i].bit_count;
+        }
+    }
+    *total_bits = total;
+    return ret_val;
+}
+
+int bit_queue_readv_bits(bit_queue_t *bq, const bit_queue_iovec_t *iov, size_t iov_count)
+{
+    int ret_val = -1;
+    size_t total_bits, tail_bits, i;
+    if (bq == NULL || iov == NULL || iov_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL && !bq->segmented)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_queue_iovec_total(iov, iov_count, &total_bits) != 0)
+    {
+        // errno is set by the iovec validation
+    }
+    else if (!bq->segmented && total_bits > bq->capacity_bits)
+    {
+        BIT_QUEUE_STAT_INC(bq, emsgsize);
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_wait_data(bq, total_bits))
+    {
+        // ret_val allready set
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else
+    {
+        // extract all the fields in one pass, the cursor stays in a register until the final publish
+        tail_bits = bit_queue_load_tail(bq);
+        for (i = 0; i < iov_count; i++)
+        {
+            if (bq->segmented)
+            {
+                bit_queue_seg_copy_out(bq, iov[i].buffer, tail_bits, iov[i].bit_count);
+            }
+            else
+            {
+                bit_queue_copy_out(bq, iov[i].buffer, 0, tail_bits, iov[i].bit_count);
+            }
+            BIT_QUEUE_STAT_OP(bq, tail_bits, iov[i].bit_count, reads, bits_read);
+            tail_bits += iov[i].bit_count;
+        }
+        bit_queue_store_tail(bq, tail_bits);
+        if (bq->segmented)
+        {
+            bit_queue_seg_release(bq);
+        }
+        ret_val = total_bits;
+    }
+    return ret_val;
+}
+
+int bit_queue_writev_bits(bit_queue_t *bq, const bit_queue_iovec_t *iov, size_t iov_count)
+{
+    int ret_val = -1;
+    size_t total_bits, head_bits, i;
+    if (bq == NULL || iov == NULL || iov_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL && !bq->segmented)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_queue_iovec_total(iov, iov_count, &total_bits) != 0)
+    {
+        // errno is set by the iovec validation
+    }
+    else if (!bq->segmented && total_bits > bq->capacity_bits)
+    {
+        BIT_QUEUE_STAT_INC(bq, emsgsize);
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_has_space(bq, total_bits))
+    {
+        // ret_val allready set
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else if (bq->segmented && bit_queue_seg_reserve(bq, total_bits) != 0)
+    {
+        // errno is set by the allocator and nothing was written
+    }
+    else
+    {
+        // pack all the fields in one pass, the cursor stays in a register until the final publish
+        head_bits = bit_queue_load_head(bq);
+        for (i = 0; i < iov_count; i++)
+        {
+            if (bq->segmented)
+            {
+                bit_queue_seg_copy_in(bq, head_bits, iov[i].buffer, iov[i].bit_count);
+            }
+            else
+            {
+                bit_queue_copy_in(bq, head_bits, iov[i].buffer, 0, iov[i].bit_count);
+            }
+            BIT_QUEUE_STAT_OP(bq, head_bits, iov[i].bit_count, writes, bits_written);
+            head_bits += iov[i].bit_count;
+        }
+        bit_queue_store_head(bq, head_bits);
+        ret_val = total_bits;
+    }
+    return ret_val;
+}
+
+int bit_queue_write_to_fd(bit_queue_t *bq, int fd, size_t bit_count)
+{
+    int ret_val = -1;
+    size_t tail_bits, byte_count = bit_count / BITS_IN_BYTE, done = 0, pos, span;
+    ssize_t sent;
+    uint8_t chunk[512];
+    if (bq == NULL || fd < 0 || bit_count == 0 || (bit_count % BITS_IN_BYTE) != 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_count > bq->capacity_bits)
+    {
+        BIT_QUEUE_STAT_INC(bq, emsgsize);
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_wait_data(bq, bit_count))
+    {
+        // ret_val allready set
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else
+    {
+        tail_bits = bit_queue_load_tail(bq);
+        while (done < byte_count)
+        {
+            span = byte_count - done;
+            if ((tail_bits % BITS_IN_BYTE) == 0)
+            {
+                // the bytes sit packed in the buffer allready, hand the fd the span up to the wrap point
+                pos = (tail_bits % bq->capacity_bits) / BITS_IN_BYTE;
+                if (span > bq->buffer_size - pos)
+                {
+                    span = bq->buffer_size - pos;
+                }
+                sent = write(fd, bq->buffer + pos, span);
+            }
+            else
+            {
+                // the cursor sits mid byte so repack through a stack chunk, one shift pass per chunk
+                if (span > sizeof(chunk))
+                {
+                    span = sizeof(chunk);
+                }
+                bit_queue_copy_out(bq, chunk, 0, tail_bits, span * BITS_IN_BYTE);
+                sent = write(fd, chunk, span);
+            }
+            if (sent <= 0)
+            {
+                // errno is set by write, the bytes that allready went out stay consumed
+                break;
+            }
+            BIT_QUEUE_STAT_OP(bq, tail_bits, (size_t)sent * BITS_IN_BYTE, reads, bits_read);
+            tail_bits += (size_t)sent * BITS_IN_BYTE;
+            bit_queue_store_tail(bq, tail_bits);
+            done += (size_t)sent;
+        }
+        if (done != 0)
+        {
+            ret_val = done * BITS_IN_BYTE;
+        }
+    }
+    return ret_val;
+}
+
+int bit_queue_read_from_fd(bit_queue_t *bq, int fd, size_t bit_count)
+{
+    int ret_val = -1;
+    size_t head_bits, byte_count = bit_count / BITS_IN_BYTE, done = 0, pos, span;
+    ssize_t got = -1;
+    uint8_t chunk[512];
+    if (bq == NULL || fd < 0 || bit_count == 0 || (bit_count % BITS_IN_BYTE) != 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_count > bq->capacity_bits)
+    {
+        BIT_QUEUE_STAT_INC(bq, emsgsize);
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_has_space(bq, bit_count))
+    {
+        // ret_val allready set
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else
+    {
+        head_bits = bit_queue_load_head(bq);
+        while (done < byte_count)
+        {
+            span = byte_count - done;
+            if ((head_bits % BITS_IN_BYTE) == 0)
+            {
+                // the bytes land straight in the buffer, nothing to copy afterwards
+                pos = (head_bits % bq->capacity_bits) / BITS_IN_BYTE;
+                if (span > bq->buffer_size - pos)
+                {
+                    span = bq->buffer_size - pos;
+                }
+                got = read(fd, bq->buffer + pos, span);
+            }
+            else
+            {
+                // the cursor sits mid byte so land in a stack chunk and shift into place
+                if (span > sizeof(chunk))
+                {
+                    span = sizeof(chunk);
+                }
+                got = read(fd, chunk, span);
+                if (got > 0)
+                {
+                    bit_queue_copy_in(bq, head_bits, chunk, 0, (size_t)got * BITS_IN_BYTE);
+                }
+            }
+            if (got <= 0)
+            {
+                // errno is set by read, the bytes that allready arrived stay published
+                break;
+            }
+            BIT_QUEUE_STAT_OP(bq, head_bits, (size_t)got * BITS_IN_BYTE, writes, bits_written);
+            head_bits += (size_t)got * BITS_IN_BYTE;
+            bit_queue_store_head(bq, head_bits);
+            done += (size_t)got;
+        }
+        if (done != 0)
+        {
+            ret_val = done * BITS_IN_BYTE;
+        }
+        else if (got == 0)
+        {
+            // end of file before the first byte
+            ret_val = 0;
+        }
+    }
+    return ret_val;
+}
+
+int bit_queue_transfer(bit_queue_t *dst, bit_queue_t *src, size_t bit_count)
+{
+    int ret_val = -1;
+    size_t head_bits, tail_bits, done = 0, src_pos, dst_pos, span;
+    if (dst == NULL || src == NULL || dst == src || bit_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (dst->buffer == NULL || src->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (dst->msb_first != src->msb_first)
+    {
+        // the physical bit layouts differ so a raw move would scramble the stream
+        errno = EINVAL;
+    }
+    else if (bit_count > dst->capacity_bits || bit_count > src->capacity_bits)
+    {
+        BIT_QUEUE_STAT_INC(src, emsgsize);
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_wait_data(src, bit_count))
+    {
+        // ret_val allready set
+        BIT_QUEUE_STAT_INC(src, eagain);
+        errno = EAGAIN;
+    }
+    else if (!bit_queue_has_space(dst, bit_count))
+    {
+        BIT_QUEUE_STAT_INC(dst, eagain);
+        errno = EAGAIN;
+    }
+    else
+    {
+        // move buffer to buffer, clipping the span at whichever ring wraps first so both sides stay
+        // contiguous, the kernel picks memcpy or the fused shift per span
+        tail_bits = bit_queue_load_tail(src);
+        head_bits = bit_queue_load_head(dst);
+        while (done < bit_count)
+        {
+            src_pos = (tail_bits + done) % src->capacity_bits;
+            dst_pos = (head_bits + done) % dst->capacity_bits;
+            span = bit_count - done;
+            if (span > src->capacity_bits - src_pos)
+            {
+                span = src->capacity_bits - src_pos;
+            }
+            if (span > dst->capacity_bits - dst_pos)
+            {
+                span = dst->capacity_bits - dst_pos;
+            }
+            bit_queue_copy_bits_mode(src->msb_first, dst->buffer, dst_pos, src->buffer, src_pos, span);
+            done += span;
+        }
+        bit_queue_store_tail(src, tail_bits + bit_count);
+        bit_queue_store_head(dst, head_bits + bit_count);
+        BIT_QUEUE_STAT_OP(src, tail_bits, bit_count, reads, bits_read);
+        BIT_QUEUE_STAT_OP(dst, head_bits, bit_count, writes, bits_written);
+        ret_val = bit_count;
+    }
+    return ret_val;
+}
+
+uint8_t bit_queue_read_u8(bit_queue_t *bq, unsigned width)
+{
+    uint64_t value = 0;
+    bit_queue_read_value(bq, width, 8, &value);
+    return (uint8_t)value;
+}
+
+uint16_t bit_queue_read_u16(bit_queue_t *bq, unsigned width)
+{
+    uint64_t value = 0;
+    bit_queue_read_value(bq, width, 16, &value);
+    return (uint16_t)value;
+}
+
+uint32_t bit_queue_read_u32(bit_queue_t *bq, unsigned width)
+{
+    uint64_t value = 0;
+    bit_queue_read_value(bq, width, 32, &value);
+    return (uint32_t)value;
+}
+
+uint64_t bit_queue_read_u64(bit_queue_t *bq, unsigned width)
+{
+    uint64_t value = 0;
+    bit_queue_read_value(bq, width, 64, &value);
+    return value;
+}
+
+int bit_queue_read_unary(bit_queue_t *bq, uint32_t *value)
+{
+    int ret_val = -1;
+    size_t run, tail_bits;
+    if (bq == NULL || value == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_queue_scan_run(bq, true, &run) != 0)
+    {
+        // errno is set by the scan
+    }
+    else
+    {
+        // consume the run and its terminating one bit, the scan proved they are queued
+        tail_bits = bit_queue_load_tail(bq);
+        bit_queue_store_tail(bq, tail_bits + run + 1);
+        BIT_QUEUE_STAT_OP(bq, tail_bits, run + 1, reads, bits_read);
+        *value = run;
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+int bit_queue_read_ue(bit_queue_t *bq, uint32_t *value)
+{
+    int ret_val = -1;
+    size_t run, tail_bits;
+    uint64_t suffix = 0;
+    if (bq == NULL || value == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_queue_scan_run(bq, true, &run) != 0)
+    {
+        // errno is set by the scan
+    }
+    else if (run > 31)
+    {
+        // the decoded code number would not fit a uint32_t, the stream is corrupt
+        errno = EILSEQ;
+    }
+    else if (!bit_queue_wait_data(bq, 2 * run + 1))
+    {
+        // the zero run is queued but the suffix is not yet
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else
+    {
+        tail_bits = bit_queue_load_tail(bq);
+        if (run != 0)
+        {
+            suffix = bit_queue_extract_mode(bq, tail_bits + run + 1, run);
+        }
+        bit_queue_store_tail(bq, tail_bits + 2 * run + 1);
+        BIT_QUEUE_STAT_OP(bq, tail_bits, 2 * run + 1, reads, bits_read);
+        *value = ((uint32_t)1 << run) - 1 + (uint32_t)suffix;
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+int bit_queue_read_varint(bit_queue_t *bq, uint64_t *value)
+{
+    int ret_val = -1;
+    int done = 0;
+    uint64_t result = 0, word, stop;
+    size_t tail_bits, consumed = 0;
+    unsigned i, byte;
+    if (bq == NULL || value == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        tail_bits = bit_queue_load_tail(bq);
+        if (bit_queue_has_data(bq, BITS_IN_WORD))
+        {
+            // fast path, one load covers 8 bytes and one count zeros over the continuation lanes finds the end
+            word = bit_queue_extract_mode(bq, tail_bits, BITS_IN_WORD);
+            if (bq->msb_first)
+            {
+                // in wire order the first byte is the top byte, swap so the byte math below is shared
+                word = __builtin_bswap64(word);
+            }
+            stop = ~word & 0x8080808080808080ull;
+            if (stop != 0)
+            {
+                consumed = ((size_t)__builtin_ctzll(stop) / BITS_IN_BYTE) + 1;
+                for (i = 0; i < consumed; i++)
+                {
+                    result |= ((word >> (i * BITS_IN_BYTE)) & 0x7f) << (7 * i);
+                }
+                done = 1;
+            }
+            else
+            {
+                // 8 continuation bytes, take them and finish in the byte loop below
+                for (i = 0; i < BITS_IN_WORD / BITS_IN_BYTE; i++)
+                {
+                    result |= ((word >> (i * BITS_IN_BYTE)) & 0x7f) << (7 * i);
+                }
+                consumed = BITS_IN_WORD / BITS_IN_BYTE;
+            }
+        }
+        // byte loop for short queues and the 9th and 10th byte of a long varint
+        while (!done && ret_val == -1)
+        {
+            if (consumed == 10)
+            {
+                // a uint64_t varint ends within 10 bytes, the stream is corrupt
+                errno = EILSEQ;
+                break;
+            }
+            if (!bit_queue_wait_data(bq, (consumed + 1) * BITS_IN_BYTE))
+            {
+                BIT_QUEUE_STAT_INC(bq, eagain);
+                errno = EAGAIN;
+                break;
+            }
+            byte = (unsigned)bit_queue_extract_mode(bq, tail_bits + consumed * BITS_IN_BYTE, BITS_IN_BYTE);
+            result |= (uint64_t)(byte & 0x7f) << (7 * consumed);
+            consumed++;
+            if ((byte & 0x80) == 0)
+            {
+                done = 1;
+            }
+        }
+        if (done)
+        {
+            // the cursor is only published here so a failed decode leaves the queue untouched
+            bit_queue_store_tail(bq, tail_bits + consumed * BITS_IN_BYTE);
+            BIT_QUEUE_STAT_OP(bq, tail_bits, consumed * BITS_IN_BYTE, reads, bits_read);
+            *value = result;
+            ret_val = 0;
+        }
+    }
+    return ret_val;
+}
+
+int bit_queue_find_bit(bit_queue_t *bq, bool value, size_t *distance)
+{
+    int ret_val = -1;
+    if (bq == NULL || distance == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        ret_val = bit_queue_scan_run(bq, value, distance);
+    }
+    return ret_val;
+}
+
+int bit_queue_skip_to(bit_queue_t *bq, bool value, size_t *distance)
+{
+    int ret_val = -1;
+    size_t run, tail_bits;
+    if (bq == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_queue_scan_run(bq, value, &run) != 0)
+    {
+        // errno is set by the scan and the cursor stays in place
+    }
+    else
+    {
+        // land the cursor on the found bit without consuming it
+        tail_bits = bit_queue_load_tail(bq);
+        bit_queue_store_tail(bq, tail_bits + run);
+        if (distance != NULL)
+        {
+            *distance = run;
+        }
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+int bit_queue_popcount(bit_queue_t *bq, size_t bit_count, size_t *count)
+{
+    int ret_val = -1;
+    size_t cursor, remaining, total = 0;
+    unsigned chunk;
+    if (bq == NULL || count == NULL || bit_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bit_count > bq->capacity_bits)
+    {
+        BIT_QUEUE_STAT_INC(bq, emsgsize);
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_wait_data(bq, bit_count))
+    {
+        // ret_val allready set
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else
+    {
+        // count whole extracted words in place, the extraction handles the wrap and the edge masking
+        cursor = bit_queue_load_tail(bq);
+        for (remaining = bit_count; remaining != 0; remaining -= chunk)
+        {
+            chunk = (remaining > BITS_IN_WORD) ? BITS_IN_WORD : (unsigned)remaining;
+            total += (size_t)__builtin_popcountll(bit_queue_extract_mode(bq, cursor, chunk));
+            cursor += chunk;
+        }
+        *count = total;
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+int bit_queue_peek_bits(bit_queue_t *bq, uint8_t *buffer, size_t bit_count)
+{
+    int ret_val = -1;
+    if (bq == NULL || buffer == NULL || bit_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL && !bq->segmented)
+    {
+        errno = EINVAL;
+    }
+    else if (!bq->segmented && bit_count > bq->capacity_bits)
+    {
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_wait_data(bq, bit_count))
+    {
+        // ret_val allready set
+        errno = EAGAIN;
+    }
+    else if (bq->segmented)
+    {
+        // same copy as a read but the cursor stays in place so no segment is released
+        bit_queue_seg_copy_out(bq, buffer, bit_queue_load_tail(bq), bit_count);
+        ret_val = bit_count;
+    }
+    else
+    {
+        // same copy as a read but the cursor stays in place
+        bit_queue_copy_out(bq, buffer, 0, bit_queue_load_tail(bq), bit_count);
+        ret_val = bit_count;
+    }
+    return ret_val;
+}
+
+int bit_queue_advance_bits(bit_queue_t *bq, size_t bit_count)
+{
+    int ret_val = -1;
+    if (bq == NULL || bit_count == 0)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL && !bq->segmented)
+    {
+        errno = EINVAL;
+    }
+    else if (!bq->segmented && bit_count > bq->capacity_bits)
+    {
+        errno = EMSGSIZE;
+    }
+    else if (!bit_queue_wait_data(bq, bit_count))
+    {
+        // ret_val allready set
+        errno = EAGAIN;
+    }
+    else
+    {
+        bit_queue_store_tail(bq, bit_queue_load_tail(bq) + bit_count);
+        if (bq->segmented)
+        {
+            bit_queue_seg_release(bq);
+        }
+        ret_val = bit_count;
+    }
+    return ret_val;
+}
+
+uint8_t * bit_queue_data_ptr(bit_queue_t *bq, size_t *byte_count)
+{
+    uint8_t * ret_val = NULL;
+    size_t pos, avail, linear;
+    if (bq == NULL || byte_count == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if ((bit_queue_load_tail(bq) % BITS_IN_BYTE) != 0)
+    {
+        // the region only makes sense on a byte boundary
+        errno = EINVAL;
+    }
+    else
+    {
+        // clamp the readable data to the contiguous span before the wrap
+        pos = bit_queue_load_tail(bq) % bq->capacity_bits;
+        avail = bit_queue_load_head(bq) - bit_queue_load_tail(bq);
+        linear = bq->capacity_bits - pos;
+        if (avail > linear)
+        {
+            avail = linear;
+        }
+        *byte_count = avail / BITS_IN_BYTE;
+        ret_val = bq->buffer + (pos / BITS_IN_BYTE);
+    }
+    return ret_val;
+}
+
+int bit_queue_mark(bit_queue_t *bq, bit_queue_mark_t *mark)
+{
+    int ret_val = -1;
+    if (bq == NULL || mark == NULL || bq->segmented)
+    {
+        // drained segments are recycled so a segmented queue has no past to mark
+        errno = EINVAL;
+    }
+    else
+    {
+        mark->head_bits = bit_queue_load_head(bq);
+        mark->tail_bits = bit_queue_load_tail(bq);
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+int bit_queue_rewind(bit_queue_t *bq, const bit_queue_mark_t *mark)
+{
+    int ret_val = -1;
+    size_t head_bits, tail_bits;
+    if (bq == NULL || mark == NULL || bq->segmented)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        head_bits = bit_queue_load_head(bq);
+        tail_bits = bit_queue_load_tail(bq);
+        if (mark->head_bits > head_bits || mark->tail_bits > tail_bits || mark->head_bits < mark->tail_bits)
+        {
+            // the mark is not from this queue's past
+            errno = EINVAL;
+        }
+        else if (head_bits - mark->tail_bits > bq->capacity_bits)
+        {
+            // the writes since the mark allready overwrote the marked data
+            errno = EINVAL;
+        }
+        else
+        {
+            bit_queue_store_head(bq, mark->head_bits);
+            bit_queue_store_tail(bq, mark->tail_bits);
+            ret_val = 0;
+        }
+    }
+    return ret_val;
+}
+
+int bit_queue_get_stats(bit_queue_t *bq, bit_queue_stats_t *stats)
+{
+    int ret_val = -1;
+    if (bq == NULL || stats == NULL)
+    {
+        errno = EINVAL;
+    }
+#ifdef BIT_QUEUE_STATS
+    else
+    {
+        *stats = bq->stats;
+        ret_val = 0;
+    }
+#else
+    else
+    {
+        // the counters are compiled out so there is nothing to report
+        errno = ENOTSUP;
+    }
+#endif
+    return ret_val;
+}
+
+int bit_queue_reset_stats(bit_queue_t *bq)
+{
+    int ret_val = -1;
+    if (bq == NULL)
+    {
+        errno = EINVAL;
+    }
+#ifdef BIT_QUEUE_STATS
+    else
+    {
+        memset(&bq->stats, 0, sizeof(bq->stats));
+        ret_val = 0;
+    }
+#else
+    else
+    {
+        // the counters are compiled out so there is nothing to reset
+        errno = ENOTSUP;
+    }
+#endif
+    return ret_val;
+}
+
+int bit_queue_destroy(bit_queue_t *bq)
+{
+    int ret_val = -1;
+    bit_queue_segment_t * seg;
+    if (bq == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->segmented)
+    {
+        // free the active chain, the freelist and the handle
+        while (bq->seg_first != NULL)
+        {
+            seg = bq->seg_first;
+            bq->seg_first = seg->next;
+            free(seg);
+        }
+        while (bq->seg_free != NULL)
+        {
+            seg = bq->seg_free;
+            bq->seg_free = seg->next;
+            free(seg);
+        }
+        free(bq);
+        ret_val = 0;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else
+    {
+        if (bq->buf_ownership == BIT_QUEUE_BUF_HEAP)
+        {
+            free(bq->buffer);
+        }
+        else if (bq->buf_ownership == BIT_QUEUE_BUF_MMAP)
+        {
+            munmap(bq->buffer, bq->map_size);
+        }
+        else if (bq->buf_ownership == BIT_QUEUE_BUF_SHM)
+        {
+            // the segment itself persists for the peer until bit_queue_shm_unlink
+            munmap(bq->shm, bq->map_size);
+        }
+        free((void *)bq->chunk_done);
+        bq->buffer = NULL;
+        if (!bq->static_handle)
+        {
+            free(bq);
+        }
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+// static functions
+
+#if BIT_QUEUE_WORD_FAST_PATH
+/**
+ * @brief This function loads a word from an unaligned address
+ *
+ * @param p The address to load from
+ * @return uint64_t The loaded word
+ */
+static inline uint64_t bit_queue_load_word(const uint8_t *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/**
+ * @brief This function stores a word to an unaligned address
+ *
+ * @param p The address to store to
+ * @param word The word to store
+ */
+static inline void bit_queue_store_word(uint8_t *p, uint64_t word)
+{
+    memcpy(p, &word, sizeof(word));
+}
+#endif // BIT_QUEUE_WORD_FAST_PATH
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief This function checks once at runtime if the host supports AVX2
+ *
+ * @return true when the AVX2 kernel can be used
+ */
+static bool bit_queue_avx2_supported(void)
+{
+    static int supported = -1;
+    if (supported < 0)
+    {
+        supported = __builtin_cpu_supports("avx2");
+    }
+    return supported > 0;
+}
+
+/**
+ * @brief This function is the AVX2 body of bit_queue_shift_copy, it moves 32 bytes per iteration
+ *
+ * The cross byte shift is built from two overlapping loads and 16 bit lane shifts with byte masks, because
+ * AVX2 has no per byte variable shift.
+ *
+ * @param dst The destination buffer, byte aligned
+ * @param src The first source byte
+ * @param shift The source bit offset, 1 to 7
+ * @param byte_count The amount of whole bytes to produce
+ * @return size_t The amount of bytes that were produced
+ */
+__attribute__((target("avx2")))
+static size_t bit_queue_shift_copy_avx2(uint8_t *dst, const uint8_t *src, uint8_t shift, size_t byte_count)
+{
+    size_t i;
+    __m256i lo_mask = _mm256_set1_epi8((char)(BYTE_MASK >> shift));
+    __m256i hi_mask = _mm256_set1_epi8((char)((BYTE_MASK << (BITS_IN_BYTE - shift)) & BYTE_MASK));
+    __m256i lo, hi;
+    for (i = 0; i + sizeof(__m256i) <= byte_count; i += sizeof(__m256i))
+    {
+        lo = _mm256_loadu_si256((const __m256i *)(src + i));
+        hi = _mm256_loadu_si256((const __m256i *)(src + i + 1));
+        lo = _mm256_and_si256(_mm256_srli_epi16(lo, shift), lo_mask);
+        hi = _mm256_and_si256(_mm256_slli_epi16(hi, BITS_IN_BYTE - shift), hi_mask);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(lo, hi));
+    }
+    return i;
+}
+#endif // defined(__x86_64__) || defined(__i386__)
+
+static void bit_queue_shift_copy(uint8_t *dst, const uint8_t *src, uint8_t shift, size_t byte_count)
+{
+    size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (bit_queue_avx2_supported())
+    {
+        i = bit_queue_shift_copy_avx2(dst, src, shift, byte_count);
+    }
+#elif defined(__ARM_NEON)
+    int8x16_t shift_right = vdupq_n_s8(-(int8_t)shift);
+    int8x16_t shift_left = vdupq_n_s8((int8_t)(BITS_IN_BYTE - shift));
+    for (; i + sizeof(uint8x16_t) <= byte_count; i += sizeof(uint8x16_t))
+    {
+        uint8x16_t lo = vshlq_u8(vld1q_u8(src + i), shift_right);
+        uint8x16_t hi = vshlq_u8(vld1q_u8(src + i + 1), shift_left);
+        vst1q_u8(dst + i, vorrq_u8(lo, hi));
+    }
+#endif
+#if BIT_QUEUE_WORD_FAST_PATH
+    uint64_t word;
+    for (; i + sizeof(uint64_t) <= byte_count; i += sizeof(uint64_t))
+    {
+        word = bit_queue_load_word(src + i) >> shift;
+        word |= (uint64_t)src[i + sizeof(uint64_t)] << (BITS_IN_WORD - shift);
+        bit_queue_store_word(dst + i, word);
+    }
+#endif // BIT_QUEUE_WORD_FAST_PATH
+    for (; i < byte_count; i++)
+    {
+        dst[i] = (src[i] >> shift) | (src[i + 1] << (BITS_IN_BYTE - shift));
+    }
+}
+
+static void bit_queue_shift_copy_msb(uint8_t *dst, const uint8_t *src, uint8_t shift, size_t byte_count)
+{
+    size_t i = 0;
+#if BIT_QUEUE_WORD_FAST_PATH
+    uint64_t word;
+    for (; i + sizeof(uint64_t) <= byte_count; i += sizeof(uint64_t))
+    {
+        // byte swapping makes the stream order the numeric order so the per byte shift is one word shift
+        word = __builtin_bswap64(bit_queue_load_word(src + i)) << shift;
+        word |= (uint64_t)src[i + sizeof(uint64_t)] >> (BITS_IN_BYTE - shift);
+        bit_queue_store_word(dst + i, __builtin_bswap64(word));
+    }
+#endif // BIT_QUEUE_WORD_FAST_PATH
+    for (; i < byte_count; i++)
+    {
+        dst[i] = (src[i] << shift) | (src[i + 1] >> (BITS_IN_BYTE - shift));
+    }
+}
+
+static void bit_queue_copy_bits_msb(uint8_t *dst, size_t dst_pos, const uint8_t *src, size_t src_pos, size_t bit_count)
+{
+    uint8_t src_off, dst_off, chunk, bits;
+    size_t byte_count;
+
+    // when both cursors sit on a byte boundary the copy is a straight memcpy, same as the LSB kernel
+    if ((src_pos % BITS_IN_BYTE) == 0 && (dst_pos % BITS_IN_BYTE) == 0 && bit_count >= BITS_IN_BYTE)
+    {
+        byte_count = bit_count / BITS_IN_BYTE;
+        memcpy(dst + (dst_pos / BITS_IN_BYTE), src + (src_pos / BITS_IN_BYTE), byte_count);
+        src_pos += byte_count * BITS_IN_BYTE;
+        dst_pos += byte_count * BITS_IN_BYTE;
+        bit_count -= byte_count * BITS_IN_BYTE;
+    }
+
+    // align the destination to a byte boundary so the bulk runs on whole bytes
+    while (bit_count >= BITS_IN_WORD && (dst_pos % BITS_IN_BYTE) != 0)
+    {
+        src_off = src_pos % BITS_IN_BYTE;
+        dst_off = dst_pos % BITS_IN_BYTE;
+        chunk = BITS_IN_BYTE - ((src_off > dst_off) ? src_off : dst_off);
+        bits = (src[src_pos / BITS_IN_BYTE] >> (BITS_IN_BYTE - src_off - chunk)) & CREATE_BYTE_MASK_LSB(BITS_IN_BYTE - chunk);
+        dst[dst_pos / BITS_IN_BYTE] &= ~(CREATE_BYTE_MASK_LSB(BITS_IN_BYTE - chunk) << (BITS_IN_BYTE - dst_off - chunk));
+        dst[dst_pos / BITS_IN_BYTE] |= bits << (BITS_IN_BYTE - dst_off - chunk);
+        src_pos += chunk;
+        dst_pos += chunk;
+        bit_count -= chunk;
+    }
+
+    // bulk shift copy of whole destination bytes, the source bit offset is constant from here on
+    if (bit_count >= BITS_IN_WORD)
+    {
+        byte_count = bit_count / BITS_IN_BYTE;
+        src_off = src_pos % BITS_IN_BYTE;
+        if (src_off == 0)
+        {
+            memcpy(dst + (dst_pos / BITS_IN_BYTE), src + (src_pos / BITS_IN_BYTE), byte_count);
+        }
+        else
+        {
+            // every bulk byte merges two source bytes; the byte past the span holds requested bits so it is in bounds
+            bit_queue_shift_copy_msb(dst + (dst_pos / BITS_IN_BYTE), src + (src_pos / BITS_IN_BYTE), src_off, byte_count);
+        }
+        src_pos += byte_count * BITS_IN_BYTE;
+        dst_pos += byte_count * BITS_IN_BYTE;
+        bit_count -= byte_count * BITS_IN_BYTE;
+    }
+
+    // byte loop for the sub word head and tail
+    while (bit_count != 0)
+    {
+        src_off = src_pos % BITS_IN_BYTE;
+        dst_off = dst_pos % BITS_IN_BYTE;
+        chunk = BITS_IN_BYTE - ((src_off > dst_off) ? src_off : dst_off);
+        if (chunk > bit_count)
+        {
+            chunk = bit_count;
+        }
+        bits = (src[src_pos / BITS_IN_BYTE] >> (BITS_IN_BYTE - src_off - chunk)) & CREATE_BYTE_MASK_LSB(BITS_IN_BYTE - chunk);
+        dst[dst_pos / BITS_IN_BYTE] &= ~(CREATE_BYTE_MASK_LSB(BITS_IN_BYTE - chunk) << (BITS_IN_BYTE - dst_off - chunk));
+        dst[dst_pos / BITS_IN_BYTE] |= bits << (BITS_IN_BYTE - dst_off - chunk);
+        src_pos += chunk;
+        dst_pos += chunk;
+        bit_count -= chunk;
+    }
+}
+
+static void bit_queue_copy_bits(uint8_t *dst, size_t dst_pos, const uint8_t *src, size_t src_pos, size_t bit_count)
+{
+    uint8_t src_off, dst_off, chunk, bits;
+    size_t byte_count;
+
+    // when both cursors sit on a byte boundary the copy is a straight memcpy
+    if ((src_pos % BITS_IN_BYTE) == 0 && (dst_pos % BITS_IN_BYTE) == 0 && bit_count >= BITS_IN_BYTE)
+    {
+        byte_count = bit_count / BITS_IN_BYTE;
+        memcpy(dst + (dst_pos / BITS_IN_BYTE), src + (src_pos / BITS_IN_BYTE), byte_count);
+        src_pos += byte_count * BITS_IN_BYTE;
+        dst_pos += byte_count * BITS_IN_BYTE;
+        bit_count -= byte_count * BITS_IN_BYTE;
+    }
+
+    // align the destination to a byte boundary so the bulk runs on whole bytes
+    while (bit_count >= BITS_IN_WORD && (dst_pos % BITS_IN_BYTE) != 0)
+    {
+        src_off = src_pos % BITS_IN_BYTE;
+        dst_off = dst_pos % BITS_IN_BYTE;
+        chunk = BITS_IN_BYTE - ((src_off > dst_off) ? src_off : dst_off);
+        bits = (src[src_pos / BITS_IN_BYTE] >> src_off) & CREATE_BYTE_MASK_LSB(BITS_IN_BYTE - chunk);
+        dst[dst_pos / BITS_IN_BYTE] &= ~(CREATE_BYTE_MASK_LSB(BITS_IN_BYTE - chunk) << dst_off);
+        dst[dst_pos / BITS_IN_BYTE] |= bits << dst_off;
+        src_pos += chunk;
+        dst_pos += chunk;
+        bit_count -= chunk;
+    }
+
+    // bulk shift copy of whole destination bytes, the source bit offset is constant from here on
+    if (bit_count >= BITS_IN_WORD)
+    {
+        byte_count = bit_count / BITS_IN_BYTE;
+        src_off = src_pos % BITS_IN_BYTE;
+        if (src_off == 0)
+        {
+            memcpy(dst + (dst_pos / BITS_IN_BYTE), src + (src_pos / BITS_IN_BYTE), byte_count);
+        }
+        else
+        {
+            // every bulk byte merges two source bytes; the byte past the span holds requested bits so it is in bounds
+            bit_queue_shift_copy(dst + (dst_pos / BITS_IN_BYTE), src + (src_pos / BITS_IN_BYTE), src_off, byte_count);
+        }
+        src_pos += byte_count * BITS_IN_BYTE;
+        dst_pos += byte_count * BITS_IN_BYTE;
+        bit_count -= byte_count * BITS_IN_BYTE;
+    }
+
+    // byte loop for the sub word head and tail
+    while (bit_count != 0)
+    {
+        src_off = src_pos % BITS_IN_BYTE;
+        dst_off = dst_pos % BITS_IN_BYTE;
+        chunk = BITS_IN_BYTE - ((src_off > dst_off) ? src_off : dst_off);
+        if (chunk > bit_count)
+        {
+            chunk = bit_count;
+        }
+        bits = (src[src_pos / BITS_IN_BYTE] >> src_off) & CREATE_BYTE_MASK_LSB(BITS_IN_BYTE - chunk);
+        dst[dst_pos / BITS_IN_BYTE] &= ~(CREATE_BYTE_MASK_LSB(BITS_IN_BYTE - chunk) << dst_off);
+        dst[dst_pos / BITS_IN_BYTE] |= bits << dst_off;
+        src_pos += chunk;
+        dst_pos += chunk;
+        bit_count -= chunk;
+    }
+}
+
+static void bit_queue_copy_out(bit_queue_t *bq, uint8_t *dst, size_t dst_pos, size_t src_cursor, size_t bit_count)
+{
+    size_t pos = src_cursor % bq->capacity_bits;
+    size_t linear = bq->capacity_bits - pos;
+    if (bit_count > linear)
+    {
+        // the copy wraps at the buffer end so it is split in two
+        bit_queue_copy_bits_mode(bq->msb_first, dst, dst_pos, bq->buffer, pos, linear);
+        bit_queue_copy_bits_mode(bq->msb_first, dst, dst_pos + linear, bq->buffer, 0, bit_count - linear);
+    }
+    else
+    {
+        bit_queue_copy_bits_mode(bq->msb_first, dst, dst_pos, bq->buffer, pos, bit_count);
+    }
+}
+
+static uint64_t bit_queue_extract_value(bit_queue_t *bq, size_t cursor, unsigned width)
+{
+    uint64_t value;
+    uint8_t tmp[sizeof(uint64_t)] = {0};
+    size_t pos = cursor % bq->capacity_bits;
+    size_t byte = pos / BITS_IN_BYTE;
+    uint8_t off = pos % BITS_IN_BYTE;
+#if BIT_QUEUE_WORD_FAST_PATH
+    if (byte + sizeof(uint64_t) < bq->buffer_size)
+    {
+        // single word load, the spill byte past the word covers any bit offset
+        value = bit_queue_load_word(bq->buffer + byte) >> off;
+        if (off != 0)
+        {
+            value |= (uint64_t)bq->buffer[byte + sizeof(uint64_t)] << (BITS_IN_WORD - off);
+        }
+    }
+    else
+#endif // BIT_QUEUE_WORD_FAST_PATH
+    {
+        // near the buffer end or across the wrap, assemble through the copy helpers
+        bit_queue_copy_out(bq, tmp, 0, cursor, width);
+#if BIT_QUEUE_WORD_FAST_PATH
+        memcpy(&value, tmp, sizeof(value));
+#else
+        // on big endian hosts rebuild the value byte by byte
+        value = 0;
+        for (unsigned i = 0; i < sizeof(tmp); i++)
+        {
+            value |= (uint64_t)tmp[i] << (i * BITS_IN_BYTE);
+        }
+#endif // BIT_QUEUE_WORD_FAST_PATH
+    }
+    if (width < BITS_IN_WORD)
+    {
+        value &= (((uint64_t)1 << width) - 1);
+    }
+    return value;
+}
+
+static uint64_t bit_queue_extract_value_msb(bit_queue_t *bq, size_t cursor, unsigned width)
+{
+    uint64_t value;
+    uint8_t tmp[sizeof(uint64_t)] = {0};
+    size_t pos = cursor % bq->capacity_bits;
+    size_t byte = pos / BITS_IN_BYTE;
+    uint8_t off = pos % BITS_IN_BYTE;
+    unsigned i;
+#if BIT_QUEUE_WORD_FAST_PATH
+    if (byte + sizeof(uint64_t) < bq->buffer_size)
+    {
+        // single byte swapped word load, the spill byte past the word covers any bit offset
+        value = __builtin_bswap64(bit_queue_load_word(bq->buffer + byte)) << off;
+        if (off != 0)
+        {
+            value |= (uint64_t)bq->buffer[byte + sizeof(uint64_t)] >> (BITS_IN_BYTE - off);
+        }
+    }
+    else
+#endif // BIT_QUEUE_WORD_FAST_PATH
+    {
+        // near the buffer end or across the wrap, assemble through the copy helpers
+        bit_queue_copy_out(bq, tmp, 0, cursor, width);
+        // the copy allready landed the first stream bit in the top bit of tmp[0]
+        value = 0;
+        for (i = 0; i < sizeof(tmp); i++)
+        {
+            value = (value << BITS_IN_BYTE) | tmp[i];
+        }
+    }
+    // the first stream bit sits in bit 63, move the field down to bit 0 keeping wire order
+    return value >> (BITS_IN_WORD - width);
+}
+
+static uint64_t bit_queue_extract_mode(bit_queue_t *bq, size_t cursor, unsigned width)
+{
+    return bq->msb_first ? bit_queue_extract_value_msb(bq, cursor, width)
+                         : bit_queue_extract_value(bq, cursor, width);
+}
+
+static int bit_queue_scan_run(bit_queue_t *bq, bool stop_value, size_t *run)
+{
+    int ret_val = -1;
+    size_t offset = 0;
+    size_t tail_bits = bit_queue_load_tail(bq);
+    size_t avail;
+    unsigned chunk, skipped;
+    uint64_t word;
+    while (ret_val == -1)
+    {
+        if (!bit_queue_wait_data(bq, offset + 1))
+        {
+            // the run covers all the queued data with no stop bit in sight
+            BIT_QUEUE_STAT_INC(bq, eagain);
+            errno = EAGAIN;
+            break;
+        }
+        avail = bit_queue_load_head(bq) - tail_bits - offset;
+        chunk = (avail > BITS_IN_WORD) ? BITS_IN_WORD : (unsigned)avail;
+        word = bit_queue_extract_mode(bq, tail_bits + offset, chunk);
+        if (!stop_value)
+        {
+            // hunting a clear bit, invert the extracted field so the zero count finds it
+            word = ~word & ((chunk < BITS_IN_WORD) ? (((uint64_t)1 << chunk) - 1) : ~(uint64_t)0);
+        }
+        if (bq->msb_first)
+        {
+            // park the first stream bit at bit 63 so the leading zero count walks in stream order
+            skipped = word ? (unsigned)__builtin_clzll(word << (BITS_IN_WORD - chunk)) : chunk;
+        }
+        else
+        {
+            skipped = word ? (unsigned)__builtin_ctzll(word) : chunk;
+        }
+        if (skipped < chunk)
+        {
+            *run = offset + skipped;
+            ret_val = 0;
+        }
+        else
+        {
+            offset += chunk;
+        }
+    }
+    return ret_val;
+}
+
+static int bit_queue_read_value(bit_queue_t *bq, unsigned width, unsigned max_width, uint64_t *value)
+{
+    int ret_val = -1;
+    size_t tail_bits;
+    if (bq == NULL || width == 0 || width > max_width)
+    {
+        errno = EINVAL;
+    }
+    else if (bq->buffer == NULL)
+    {
+        errno = EINVAL;
+    }
+    else if (!bit_queue_wait_data(bq, width))
+    {
+        // ret_val allready set
+        BIT_QUEUE_STAT_INC(bq, eagain);
+        errno = EAGAIN;
+    }
+    else
+    {
+        tail_bits = bit_queue_load_tail(bq);
+        *value = bit_queue_extract_mode(bq, tail_bits, width);
+        bit_queue_store_tail(bq, tail_bits + width);
+        BIT_QUEUE_STAT_OP(bq, tail_bits, width, reads, bits_read);
+        ret_val = 0;
+    }
+    return ret_val;
+}
+
+static void bit_queue_copy_in(bit_queue_t *bq, size_t dst_cursor, const uint8_t *src, size_t src_pos, size_t bit_count)
+{
+    size_t pos = dst_cursor % bq->capacity_bits;
+    size_t linear = bq->capacity_bits - pos;
+    if (bit_count > linear)
+    {
+        // the copy wraps at the buffer end so it is split in two
+        bit_queue_copy_bits_mode(bq->msb_first, bq->buffer, pos, src, src_pos, linear);
+        bit_queue_copy_bits_mode(bq->msb_first, bq->buffer, 0, src, src_pos + linear, bit_count - linear);
+    }
+    else
+    {
+        bit_queue_copy_bits_mode(bq->msb_first, bq->buffer, pos, src, src_pos, bit_count);
+    }
+}
+
+static int bit_queue_seg_reserve(bit_queue_t *bq, size_t bit_count)
+{
+    int ret_val = 0;
+    bit_queue_segment_t * seg;
+    size_t used = bit_queue_load_head(bq) - bq->seg_base_bits;
+    while (ret_val == 0 && used + bit_count > bq->seg_count * bq->segment_bits)
+    {
+        if (bq->seg_free != NULL)
+        {
+            // recycle a drained segment first, its cache lines are likely still warm
+            seg = bq->seg_free;
+            bq->seg_free = seg->next;
+        }
+        else if (!(seg = malloc(sizeof(bit_queue_segment_t) + bq->segment_bits / BITS_IN_BYTE)))
+        {
+            // errno is set by malloc and the queued data is untouched
+            ret_val = -1;
+        }
+        if (ret_val == 0)
+        {
+            seg->next = NULL;
+            bq->seg_last->next = seg;
+            bq->seg_last = seg;
+            bq->seg_count++;
+        }
+    }
+    return ret_val;
+}
+
+static void bit_queue_seg_copy_out(bit_queue_t *bq, uint8_t *dst, size_t src_cursor, size_t bit_count)
+{
+    bit_queue_segment_t * seg = bq->seg_first;
+    size_t rel = src_cursor - bq->seg_base_bits;
+    size_t dst_pos = 0;
+    size_t chunk;
+    // skip to the segment holding the cursor, for a read from the tail this loop does not run
+    while (rel >= bq->segment_bits)
+    {
+        rel -= bq->segment_bits;
+        seg = seg->next;
+    }
+    while (bit_count != 0)
+    {
+        chunk = bq->segment_bits - rel;
+        if (chunk > bit_count)
+        {
+            chunk = bit_count;
+        }
+        bit_queue_copy_bits(dst, dst_pos, seg->data, rel, chunk);
+        dst_pos += chunk;
+        bit_count -= chunk;
+        rel = 0;
+        seg = seg->next;
+    }
+}
+
+static void bit_queue_seg_copy_in(bit_queue_t *bq, size_t dst_cursor, const uint8_t *src, size_t bit_count)
+{
+    bit_queue_segment_t * seg = bq->seg_first;
+    size_t rel = dst_cursor - bq->seg_base_bits;
+    size_t src_pos = 0;
+    size_t chunk;
+    while (rel >= bq->segment_bits)
+    {
+        rel -= bq->segment_bits;
+        seg = seg->next;
+    }
+    while (bit_count != 0)
+    {
+        chunk = bq->segment_bits - rel;
+        if (chunk > bit_count)
+        {
+            chunk = bit_count;
+        }
+        bit_queue_copy_bits(seg->data, rel, src, src_pos, chunk);
+        src_pos += chunk;
+        bit_count -= chunk;
+        rel = 0;
+        seg = seg->next;
+    }
+}
+
+static void bit_queue_seg_release(bit_queue_t *bq)
+{
+    bit_queue_segment_t * seg;
+    size_t tail_bits = bit_queue_load_tail(bq);
+    while (bq->seg_first != bq->seg_last && tail_bits - bq->seg_base_bits >= bq->segment_bits)
+    {
+        seg = bq->seg_first;
+        bq->seg_first = seg->next;
+        seg->next = bq->seg_free;
+        bq->seg_free = seg;
+        bq->seg_base_bits += bq->segment_bits;
+        bq->seg_count--;
+    }
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
  * @defgroup bit_queue
  * This module was created for supporting read and write operations on a buffer with diffrent bit sizes.
  */
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -16,19 +17,89 @@
 typedef struct _bit_queue_t bit_queue_t;
 
 /**
- * @brief This function allocates the bit_queue and buffer and initializes it 
+ * @brief The size in bytes of the opaque storage that can hold a bit queue handle
+ */
+#define BIT_QUEUE_STORAGE_SIZE 448
+
+/**
+ * @brief Opaque caller owned storage for a bit queue handle
+ *
+ * Place this on the stack or in an arena and hand it to bit_queue_init_static to build a queue with zero
+ * allocations. The alignment matches the cache line separation of the internal cursors.
+ */
+typedef struct
+{
+    unsigned char opaque[BIT_QUEUE_STORAGE_SIZE];
+} __attribute__((aligned(64))) bit_queue_storage_t;
+
+/**
+ * @brief This flag selects MSB first bit order inside each byte
+ *
+ * In this order the first bit of the stream is the most significant bit of the first byte, like network
+ * protocols and most codecs lay out their fields, so extracted values come out in wire order with no
+ * reversal pass. The default order is LSB first.
+ */
+#define BIT_QUEUE_FLAG_MSB_FIRST (1u << 0)
+
+/**
+ * @brief This flag allocates the data buffer without zeroing it
+ *
+ * The cursors allready bound the valid region, a read can only see bits that were written, so zeroing every
+ * page of a large buffer up front is pure cold start cost. Only meaningful for the allocating init functions,
+ * handing it to bit_queue_init_ex is refused.
+ */
+#define BIT_QUEUE_FLAG_NOZERO (1u << 1)
+
+/**
+ * @brief This flag backs the data buffer with a MAP_NORESERVE anonymous mapping
+ *
+ * Physical pages are faulted in only as the write cursor reaches them, so a large queue that stays mostly
+ * empty costs address space instead of memory. Only meaningful for the allocating init functions, handing it
+ * to bit_queue_init_ex is refused.
+ */
+#define BIT_QUEUE_FLAG_LAZY (1u << 2)
+
+/**
+ * @brief This flag backs the data buffer with 2 MB huge pages
+ *
+ * A large queue streamed with the read and write loops takes a dTLB miss every 4 KB on normal pages; huge
+ * pages cut that by 512x. The buffer is mapped with MAP_HUGETLB when the host has reserved huge pages and
+ * falls back to a normal mapping advised with MADV_HUGEPAGE otherwise, so it degrades to transparent huge
+ * pages instead of failing. Combinable with BIT_QUEUE_FLAG_LAZY. Only meaningful for the allocating init
+ * functions, handing it to bit_queue_init_ex is refused.
+ */
+#define BIT_QUEUE_FLAG_HUGEPAGES (1u << 3)
+
+/**
+ * @brief This function allocates the bit_queue and buffer and initializes it
  * errno options:
  * 1) Sets errno EINVAL if byte_count = 0
  * 2) The errno is set by the allocation method
- * 
+ *
  * @ingroup bit_queue
- * 
+ *
  * @param byte_count the size of the bit queue buffer in bytes
- * 
+ *
  * @return bit_queue_t* Address of the created bit queue or NULL in failure
  */
 bit_queue_t * bit_queue_base_init(size_t byte_count);
 
+/**
+ * @brief This function works like bit_queue_base_init with behavior flags
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if byte_count = 0 or flags holds an unknown flag
+ * 2) The errno is set by the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param byte_count the size of the bit queue buffer in bytes
+ * @param flags A bitwise or of BIT_QUEUE_FLAG_* values or 0
+ *
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_base_init_ex(size_t byte_count, unsigned flags);
+
 /**
  * @brief This function allocates the bit_queue sets the buffer and initializes it. The function assumes that the buffer is full of data.
  * 
@@ -46,6 +117,308 @@ bit_queue_t * bit_queue_base_init(size_t byte_count);
  */
 bit_queue_t * bit_queue_init(uint8_t *buffer, size_t byte_count, bool free_buff);
 
+/**
+ * @brief This function works like bit_queue_init with behavior flags
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if byte_count = 0 or buffer = NULL or flags holds an unknown flag
+ * 2) The errno is set by the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param buffer The buffer to use for the queue
+ * @param byte_count The size of the buffer in bytes
+ * @param free_buff This flag is used to tell the bit queue if durring the destroy function it should free the buffer that was given.
+ * @param flags A bitwise or of BIT_QUEUE_FLAG_* values or 0
+ *
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_init_ex(uint8_t *buffer, size_t byte_count, bool free_buff, unsigned flags);
+
+/**
+ * @brief This function creates a bit queue for single producer single consumer use across two threads
+ *
+ * The queue works like one from bit_queue_base_init but the read and write cursors live on separate cache
+ * lines and are accessed with acquire/release ordering, so exactly one producer thread may call the write
+ * functions and exactly one consumer thread may call the read functions with no external lock.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if byte_count = 0
+ * 2) The errno is set by the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param byte_count the size of the bit queue buffer in bytes
+ *
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_spsc_init(size_t byte_count);
+
+/**
+ * @brief One claimed chunk of a multi consumer queue
+ *
+ * The data points straight into the queue buffer, the consumer parses it in place on a private cursor,
+ * for example with bit_queue_init_static over data, and then hands the struct back to
+ * bit_queue_chunk_release.
+ */
+typedef struct
+{
+    uint8_t * data; /// The chunk bytes inside the queue buffer
+    size_t byte_count; /// The chunk size in bytes
+    size_t chunk_index; /// Internal bookkeeping for the release, do not touch
+} bit_queue_chunk_t;
+
+/**
+ * @brief This function creates a bit queue where many consumer threads claim whole chunks in parallel
+ *
+ * One producer thread fills the queue with the write functions like in spsc mode. The consumers do not use
+ * the read functions, instead each worker claims the next whole chunk with bit_queue_chunk_claim, one
+ * compare and swap on a dedicated claim cursor, parses the chunk bits on its own private cursor and then
+ * releases it. The workers only contend once per chunk instead of once per field, so decode throughput
+ * scales across cores. The producer is expected to pad its stream to whole chunks, a partial chunk is not
+ * claimable.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if byte_count = 0 or chunk_bytes = 0 or byte_count is not a multiple of chunk_bytes,
+ *    a chunk must never wrap at the buffer end
+ * 2) The errno is set by the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param byte_count the size of the bit queue buffer in bytes
+ * @param chunk_bytes the claim granularity in bytes
+ *
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_mc_init(size_t byte_count, size_t chunk_bytes);
+
+/**
+ * @brief This function claims the next whole chunk of queued data for the calling consumer thread
+ *
+ * The claim is one compare and swap, after it the chunk bytes belong to this thread alone until the
+ * release, no lock is held while parsing.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or chunk = NULL or the queue is not from bit_queue_mc_init
+ * 2) Sets errno to EAGAIN if there isn't a whole unclaimed chunk in the queue
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The multi consumer bit queue
+ * @param chunk Out parameter describing the claimed chunk
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_chunk_claim(bit_queue_t *bq, bit_queue_chunk_t *chunk);
+
+/**
+ * @brief This function returns a parsed chunk so the producer can reuse its bytes
+ *
+ * Chunks may be released in any order, the space is handed back to the producer as the run of released
+ * chunks behind the read cursor becomes contiguous. Releasing a chunk twice is undefined.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or chunk = NULL or the queue is not from bit_queue_mc_init
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The multi consumer bit queue
+ * @param chunk The chunk from bit_queue_chunk_claim
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_chunk_release(bit_queue_t *bq, bit_queue_chunk_t *chunk);
+
+/**
+ * @brief This function creates a read only bit queue layered directly over a memory mapped file
+ *
+ * The whole file is mapped and adopted as a full buffer like in bit_queue_init, so a packed capture file can
+ * be replayed with zero staging copies. The mapping is advised for sequential access. The queue is read only:
+ * calling the write functions on it is undefined because the pages are mapped PROT_READ.
+ * bit_queue_destroy unmaps the file.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if path = NULL or the file is empty
+ * 2) The errno is set by open, fstat, mmap or the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param path The file to map
+ *
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_mmap_init(const char *path);
+
+/**
+ * @brief This function creates a named shared memory queue for zero copy cross process streaming
+ *
+ * The cursors and the data buffer both live in a shm_open segment, so a producer process and a consumer
+ * process stream bits to each other with no socket copies and no syscalls on the data path. The cursors use
+ * the spsc acquire/release discipline across the processes: exactly one process may write and exactly one may
+ * read. The returned handle is local, bit_queue_destroy unmaps the segment and frees the handle while the
+ * segment itself persists until bit_queue_shm_unlink.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if name = NULL or byte_count = 0
+ * 2) The errno is set by shm_open, ftruncate, mmap or the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param name The shm segment name, see shm_open for the naming rules
+ * @param byte_count The size of the queue buffer in bytes
+ *
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_shm_create(const char *name, size_t byte_count);
+
+/**
+ * @brief This function attaches to a shared memory queue created by bit_queue_shm_create in another process
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if name = NULL
+ * 2) Sets errno to EPROTO if the segment does not carry a bit queue control block
+ * 3) The errno is set by shm_open, fstat, mmap or the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param name The shm segment name the creator used
+ *
+ * @return bit_queue_t* Address of the attached bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_shm_attach(const char *name);
+
+/**
+ * @brief This function removes a shared memory queue segment from the system
+ *
+ * Call it once per segment when the streaming is over, attached processes keep their mapping until they
+ * destroy their handles.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if name = NULL
+ * 2) The errno is set by shm_unlink
+ *
+ * @ingroup bit_queue
+ *
+ * @param name The shm segment name the creator used
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_shm_unlink(const char *name);
+
+/**
+ * @brief This function initializes a bit queue inside caller owned storage with zero allocations
+ *
+ * Nothing is allocated and nothing is freed: the handle lives in storage and the data lives in buffer, both
+ * owned by the caller. bit_queue_destroy on such a queue only invalidates the handle. When full is true the
+ * buffer is assumed to be full of data like in bit_queue_init, otherwise the queue starts empty.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if storage = NULL or buffer = NULL or byte_count = 0
+ *
+ * @ingroup bit_queue
+ *
+ * @param storage Caller owned storage for the handle, stack or arena
+ * @param buffer The buffer to use for the queue
+ * @param byte_count The size of the buffer in bytes
+ * @param full Whether the buffer allready holds data
+ *
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_init_static(bit_queue_storage_t *storage, uint8_t *buffer, size_t byte_count, bool full);
+
+/**
+ * @brief This function creates a queue that grows by chaining fixed size segments on demand
+ *
+ * The queue starts with one segment and appends another whenever a write runs past the chain, so memory tracks
+ * the actual occupancy instead of a worst case picked up front, and writes never fail with EMSGSIZE. Reads push
+ * fully drained segments onto an internal freelist where the next growth picks them up first, keeping the hot
+ * segments cache resident instead of bouncing through the allocator. A write fails with ENOMEM when a needed
+ * segment cannot be allocated, changing nothing.
+ *
+ * Only the core surface works on a segmented queue: the read, write, peek and advance functions, the readv and
+ * writev functions, the has and refill checks and bit_queue_destroy. The operations that need the flat buffer,
+ * the typed and variable length readers, the scans, bit_queue_data_ptr, mark and rewind and the unchecked
+ * functions, fail with EINVAL.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if segment_bytes = 0
+ * 2) The errno is set by the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param segment_bytes The payload size of one segment in bytes
+ *
+ * @return bit_queue_t* Address of the created bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_segmented_init(size_t segment_bytes);
+
+typedef struct _bit_queue_pool_t bit_queue_pool_t;
+
+/**
+ * @brief This function creates a pool of bit queues for high churn acquire/release cycles
+ *
+ * The pool pre allocates an array of handles and one contiguous slab of buffers, so acquiring and releasing a
+ * queue is an O(1) freelist operation with no allocator traffic. The pool is not thread safe by itself, use
+ * one pool per thread to take allocator contention to zero.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if count = 0 or byte_count = 0
+ * 2) The errno is set by the allocation method
+ *
+ * @ingroup bit_queue
+ *
+ * @param count The amount of queues in the pool
+ * @param byte_count The buffer size of each queue in bytes
+ *
+ * @return bit_queue_pool_t* Address of the created pool or NULL in failure
+ */
+bit_queue_pool_t * bit_queue_pool_create(size_t count, size_t byte_count);
+
+/**
+ * @brief This function takes an empty bit queue from the pool
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if pool = NULL
+ * 2) Sets errno to EAGAIN if all the queues in the pool are acquired
+ *
+ * @ingroup bit_queue
+ *
+ * @param pool The pool to acquire from
+ *
+ * @return bit_queue_t* Address of the acquired bit queue or NULL in failure
+ */
+bit_queue_t * bit_queue_pool_acquire(bit_queue_pool_t *pool);
+
+/**
+ * @brief This function returns an acquired bit queue to the pool
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if pool = NULL or bq = NULL or bq does not belong to the pool
+ *
+ * @ingroup bit_queue
+ *
+ * @param pool The pool the queue was acquired from
+ * @param bq The bit queue to return
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_pool_release(bit_queue_pool_t *pool, bit_queue_t *bq);
+
+/**
+ * @brief Destroyes the pool and frees the handles and the buffer slab
+ *
+ * All the queues acquired from the pool become invalid, do not call bit_queue_destroy on them.
+ *
+ * Sets errno to EINVAL if pool = NULL
+ *
+ * @ingroup bit_queue
+ *
+ * @param pool The pool to destroy
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_pool_destroy(bit_queue_pool_t *pool);
+
 /**
  * @brief This function copys bits from the bit queue buffer into the buffer
  * 
@@ -70,17 +443,603 @@ int bit_queue_read_bits(bit_queue_t *bq, uint8_t *buffer, size_t bit_count);
  * errno options:
  * 1) Sets errno EINVAL if byte_count = 0 or buffer = NULL or bq = NULL or bq->buffer = NULL
  * 2) Sets errno to EMSGSIZE if the bit count is larger the the entire bit queue buffer 
- * 3) Sets errno to EAGAIN if there isn't enough data in the queue
- * 
+ * 3) Sets errno to EAGAIN if there isn't enough space in the queue
+ *
  * @ingroup bit_queue
- * 
+ *
  * @param bq The destination bit queue
  * @param buffer The source buffer
  * @param bit_count The amount of bits to write
  * 
  * @return int The number of bits written or -1 in failure
  */
-int bit_queue_read_write(bit_queue_t *bq, uint8_t *buffer, size_t bit_count);
+int bit_queue_write_bits(bit_queue_t *bq, uint8_t *buffer, size_t bit_count);
+
+/**
+ * @brief The refill callback type used by bit_queue_set_refill
+ *
+ * The callback should top the queue up, usually with the write functions, and return the amount of bits it
+ * added. A return of 0 or less stops the refill loop and the pending read fails with EAGAIN.
+ */
+typedef int (*bit_queue_refill_cb_t)(bit_queue_t *bq, void *ctx);
+
+/**
+ * @brief This function installs a refill callback that is pulled when a read finds too little data
+ *
+ * With a refill callback a small resident buffer can front an unbounded stream: whenever a read, peek or
+ * advance would fail with EAGAIN the callback is invoked repeatedly until enough data is queued or it reports
+ * no progress. The callback runs in the context of the reading thread, so refill is meant for single threaded
+ * queues, not for spsc ones where the producer side allready runs elsewhere.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param callback The refill callback or NULL to remove it
+ * @param ctx An opaque pointer handed to the callback
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_set_refill(bit_queue_t *bq, bit_queue_refill_cb_t callback, void *ctx);
+
+/**
+ * @brief One field descriptor for the scatter gather read and write functions
+ */
+typedef struct
+{
+    uint8_t * buffer; /// The destination or source buffer of the field
+    size_t bit_count; /// The width of the field in bits
+} bit_queue_iovec_t;
+
+/**
+ * @brief This function reads a whole array of fields in one validated pass
+ *
+ * The total width of all the fields is validated once and the cursor is published once at the end, so
+ * extracting a multi field header costs one checked call instead of one per field.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or bq->buffer = NULL or iov = NULL or iov_count = 0 or an entry has
+ *    buffer = NULL or bit_count = 0
+ * 2) Sets errno to EMSGSIZE if the total bit count is larger the the entire bit queue buffer
+ * 3) Sets errno to EAGAIN if there isn't enough data in the queue for all the fields
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param iov The array of field descriptors
+ * @param iov_count The amount of fields
+ *
+ * @return int The total number of bits read or -1 in failure
+ */
+int bit_queue_readv_bits(bit_queue_t *bq, const bit_queue_iovec_t *iov, size_t iov_count);
+
+/**
+ * @brief This function writes a whole array of fields in one validated pass
+ *
+ * The mirror of bit_queue_readv_bits for the producer side, with the same errno options except that EAGAIN
+ * means there isn't enough space in the queue for all the fields.
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The destination bit queue
+ * @param iov The array of field descriptors
+ * @param iov_count The amount of fields
+ *
+ * @return int The total number of bits written or -1 in failure
+ */
+int bit_queue_writev_bits(bit_queue_t *bq, const bit_queue_iovec_t *iov, size_t iov_count);
+
+/**
+ * @brief This function drains bits from the queue straight into a file descriptor
+ *
+ * The bytes go out with plain write calls directly from the internal buffer when the read cursor is byte
+ * aligned, so the staging buffer per connection goes away. When the cursor sits mid byte the bits are
+ * repacked through a small stack chunk with the bulk shift kernel, still one pass over the data. Short
+ * writes are fine, the read cursor only advances over the bytes the fd accepted, so the call works on
+ * nonblocking sockets and can simply be retried.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or bq->buffer = NULL or fd < 0 or bit_count = 0 or bit_count is not a
+ *    whole amount of bytes, a file descriptor only moves whole bytes
+ * 2) Sets errno to EMSGSIZE if the amount of bits requested is larger then the entire bit queue buffer
+ * 3) Sets errno to EAGAIN if there isn't enough data in the queue
+ * 4) The errno is set by write when the fd refuses the very first byte
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param fd The destination file descriptor
+ * @param bit_count The amount of bits to drain, must be a multiple of 8
+ *
+ * @return int The number of bits actually drained or -1 in failure
+ */
+int bit_queue_write_to_fd(bit_queue_t *bq, int fd, size_t bit_count);
+
+/**
+ * @brief This function fills the queue straight from a file descriptor
+ *
+ * The mirror of bit_queue_write_to_fd for the producer side, the bytes land directly in the internal buffer
+ * when the write cursor is byte aligned. A short read stops early and only the bytes that arrived are
+ * published, end of file before the first byte returns 0.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or bq->buffer = NULL or fd < 0 or bit_count = 0 or bit_count is not a
+ *    whole amount of bytes
+ * 2) Sets errno to EMSGSIZE if the amount of bits requested is larger then the entire bit queue buffer
+ * 3) Sets errno to EAGAIN if there isn't enough space in the queue
+ * 4) The errno is set by read when the fd fails before the first byte
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The destination bit queue
+ * @param fd The source file descriptor
+ * @param bit_count The amount of bits to fill, must be a multiple of 8
+ *
+ * @return int The number of bits actually filled, 0 in end of file or -1 in failure
+ */
+int bit_queue_read_from_fd(bit_queue_t *bq, int fd, size_t bit_count);
+
+/**
+ * @brief This function moves bits from one queue into another without a scratch buffer
+ *
+ * The bits go directly between the two internal buffers in one pass, a memcpy when both cursors are byte
+ * aligned and a single fused shift otherwise, so re framing a payload touches the data once instead of
+ * twice. The move is all or nothing, a failure leaves both queues untouched. Both queues must use the same
+ * bit order.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if dst = NULL or src = NULL or dst = src or either buffer = NULL or bit_count = 0
+ *    or the queues disagree on BIT_QUEUE_FLAG_MSB_FIRST
+ * 2) Sets errno to EMSGSIZE if the amount of bits requested is larger then either queue's buffer
+ * 3) Sets errno to EAGAIN if there isn't enough data in src or enough space in dst
+ *
+ * @ingroup bit_queue
+ *
+ * @param dst The destination bit queue
+ * @param src The source bit queue
+ * @param bit_count The amount of bits to move
+ *
+ * @return int The number of bits moved or -1 in failure
+ */
+int bit_queue_transfer(bit_queue_t *dst, bit_queue_t *src, size_t bit_count);
+
+/**
+ * @brief This function reads up to 8 bits and returns the value directly
+ *
+ * The first bit of the stream lands in bit 0 of the value, or in the top bit of the width sized field on a
+ * BIT_QUEUE_FLAG_MSB_FIRST queue, so the value is allready in wire order. Returning by value keeps field
+ * extraction in registers instead of bouncing through a destination buffer. A failed read returns 0, so callers that can
+ * see a legit 0 value should clear errno before the call and check it after.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or bq->buffer = NULL or width = 0 or width > 8
+ * 2) Sets errno to EAGAIN if there isn't enough data in the queue
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param width The amount of bits to read
+ *
+ * @return uint8_t The extracted value or 0 in failure
+ */
+uint8_t bit_queue_read_u8(bit_queue_t *bq, unsigned width);
+
+/**
+ * @brief This function reads up to 16 bits and returns the value directly
+ *
+ * See bit_queue_read_u8 for the value layout and the errno handling, here the width limit is 16.
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param width The amount of bits to read
+ *
+ * @return uint16_t The extracted value or 0 in failure
+ */
+uint16_t bit_queue_read_u16(bit_queue_t *bq, unsigned width);
+
+/**
+ * @brief This function reads up to 32 bits and returns the value directly
+ *
+ * See bit_queue_read_u8 for the value layout and the errno handling, here the width limit is 32.
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param width The amount of bits to read
+ *
+ * @return uint32_t The extracted value or 0 in failure
+ */
+uint32_t bit_queue_read_u32(bit_queue_t *bq, unsigned width);
+
+/**
+ * @brief This function reads up to 64 bits and returns the value directly
+ *
+ * See bit_queue_read_u8 for the value layout and the errno handling, here the width limit is 64.
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param width The amount of bits to read
+ *
+ * @return uint64_t The extracted value or 0 in failure
+ */
+uint64_t bit_queue_read_u64(bit_queue_t *bq, unsigned width);
+
+/**
+ * @brief This function reads a unary code, a run of zero bits closed by a one bit
+ *
+ * The whole run is resolved with one word load and a count trailing (or leading, on a MSB first queue) zeros
+ * instruction instead of a read per bit, with a loop only for runs longer then a word. The terminating one bit
+ * is consumed together with the run.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or value = NULL or bq->buffer = NULL
+ * 2) Sets errno to EAGAIN if the run is not terminated within the queued data
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param value Out parameter that receives the length of the zero run
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_read_unary(bit_queue_t *bq, uint32_t *value);
+
+/**
+ * @brief This function reads an unsigned Exp-Golomb code like the ones all over H.264/H.265 headers
+ *
+ * The code is lz zero bits, a one bit and then lz suffix bits, decoding to 2^lz - 1 + suffix. The zero run is
+ * resolved in O(1) like in bit_queue_read_unary and the suffix is one value extraction, so the cost no longer
+ * scales with the code length. The suffix bits follow the queue's bit order. The cursor only moves when the
+ * whole code was decoded, a failure leaves it in place.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or value = NULL or bq->buffer = NULL
+ * 2) Sets errno to EAGAIN if the whole code is not within the queued data
+ * 3) Sets errno to EILSEQ if the zero run is longer then 31, such a code does not fit a uint32_t
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param value Out parameter that receives the decoded code number
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_read_ue(bit_queue_t *bq, uint32_t *value);
+
+/**
+ * @brief This function measures the distance from the read cursor to the next bit with the wanted value
+ *
+ * The scan runs a word at a time over the queue buffer with a hardware bit scan instead of a read per bit, so
+ * hunting a sync pattern costs O(n / 64) instead of O(n) calls. Nothing is consumed, pair it with
+ * bit_queue_skip_to or bit_queue_advance_bits to move the cursor.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or distance = NULL or bq->buffer = NULL
+ * 2) Sets errno to EAGAIN if no such bit is within the queued data
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param value The bit value to hunt for
+ * @param distance Out parameter that receives the distance in bits from the read cursor
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_find_bit(bit_queue_t *bq, bool value, size_t *distance);
+
+/**
+ * @brief This function advances the read cursor to the next bit with the wanted value
+ *
+ * The found bit itself is not consumed, the next read starts on it. On failure the cursor stays in place, the
+ * skipped prefix is only given up once the wanted bit was actually found.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or bq->buffer = NULL
+ * 2) Sets errno to EAGAIN if no such bit is within the queued data
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param value The bit value to hunt for
+ * @param distance Optional out parameter that receives the amount of skipped bits, may be NULL
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_skip_to(bit_queue_t *bq, bool value, size_t *distance);
+
+/**
+ * @brief This function reads a LEB128 style varint, 7 payload bits per byte with the top bit as continuation
+ *
+ * When a whole word of data is queued the terminating byte is found with one load and one count zeros over the
+ * continuation bit lanes, so the common short varint costs O(1) instead of a read per byte. The cursor only
+ * moves when the whole varint was decoded, a failure leaves it in place.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or value = NULL or bq->buffer = NULL
+ * 2) Sets errno to EAGAIN if the varint is not terminated within the queued data
+ * 3) Sets errno to EILSEQ if the varint runs past 10 bytes, such a value does not fit a uint64_t
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param value Out parameter that receives the decoded value
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_read_varint(bit_queue_t *bq, uint64_t *value);
+
+/**
+ * @brief This function copys bits from the bit queue buffer into the buffer without any validation
+ *
+ * This is the hot path variant of bit_queue_read_bits. It skips the argument checks, the EMSGSIZE bound and the
+ * data check, so the caller must have allready established that the queue is valid and holds bit_count bits,
+ * for example with one up front bit_queue_has_data call covering a whole batch of reads. Not for segmented
+ * queues, those have no flat buffer to extract from.
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param buffer The destintion buffer
+ * @param bit_count The amount of bits to read
+ *
+ * @return int The number of bits read
+ */
+int bit_queue_read_bits_unchecked(bit_queue_t *bq, uint8_t *buffer, size_t bit_count);
+
+/**
+ * @brief This function copys bits from the buffer into the bit queue buffer without any validation
+ *
+ * This is the hot path variant of bit_queue_write_bits. It skips the argument checks, the EMSGSIZE bound and the
+ * space check, so the caller must have allready established that the queue is valid and has room for bit_count
+ * bits, for example with one up front bit_queue_has_space call covering a whole batch of writes. Not for
+ * segmented queues, those have no flat buffer to pack into.
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The destination bit queue
+ * @param buffer The source buffer
+ * @param bit_count The amount of bits to write
+ *
+ * @return int The number of bits written
+ */
+int bit_queue_write_bits_unchecked(bit_queue_t *bq, uint8_t *buffer, size_t bit_count);
+
+/**
+ * @brief One per queue request for bit_queue_read_bits_multi
+ */
+typedef struct
+{
+    uint8_t * buffer; /// The destination buffer of the read
+    size_t bit_count; /// The amount of bits to read
+    int result; /// Out field, the number of bits read or -1 when the entry failed
+} bit_queue_request_t;
+
+/**
+ * @brief This function reads from a whole array of queues, hiding the cache misses of the pointer chases
+ *
+ * Draining thousands of small queues in a loop takes a cold miss on each handle and another on each buffer.
+ * This walk prefetches the handle two queues ahead and the buffer byte at the read cursor one queue ahead, so
+ * the memory latency overlaps the extraction work of the current queue. Each entry behaves exactly like a
+ * bit_queue_read_bits call with its result stored in the request, a failed entry does not stop the walk.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if queues = NULL or reqs = NULL or count = 0
+ * 2) A failed entry leaves the errno of its bit_queue_read_bits call, inspect the per entry results
+ *
+ * @ingroup bit_queue
+ *
+ * @param queues The array of queues to read from
+ * @param reqs The array of requests, one per queue
+ * @param count The amount of queues
+ *
+ * @return int The amount of entries that read successfully or -1 in failure
+ */
+int bit_queue_read_bits_multi(bit_queue_t **queues, bit_queue_request_t *reqs, size_t count);
+
+/**
+ * @brief This function checks if there is enough data to read
+ *
+ * Sets errno to EINVAL if bq = NULL
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param bit_count The number of bits we want to read
+ *
+ * @return true if there is sufficient data in the queue false otherwise
+ */
+bool bit_queue_has_data(bit_queue_t *bq, size_t bit_count);
+
+/**
+ * @brief This function checks if there is enough space to write all of the bits
+ *
+ * Sets errno to EINVAL if bq = NULL
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param bit_count The number of bits we want to write
+ *
+ * @return true if there is sufficient space in the queue false otherwise
+ */
+bool bit_queue_has_space(bit_queue_t *bq, size_t bit_count);
+
+/**
+ * @brief This function counts the set bits in the next bit_count queued bits without copying or advancing
+ *
+ * The count runs directly over the queue buffer a word at a time with a hardware population count, so sampling
+ * the density of a queued bitmap no longer needs an extract copy into a scratch buffer. The cursor stays in
+ * place, pair it with bit_queue_advance_bits to consume the counted range.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or count = NULL or bit_count = 0 or bq->buffer = NULL
+ * 2) Sets errno to EMSGSIZE if the bit count is larger the the entire bit queue buffer
+ * 3) Sets errno to EAGAIN if there isn't enough data in the queue
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param bit_count The amount of bits to count over
+ * @param count Out parameter that receives the amount of set bits
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_popcount(bit_queue_t *bq, size_t bit_count, size_t *count);
+
+/**
+ * @brief This function copys bits from the bit queue buffer into the buffer without advancing the read cursor
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bit_count = 0 or buffer = NULL or bq = NULL or bq->buffer = NULL
+ * 2) Sets errno to EMSGSIZE if the bit count is larger the the entire bit queue buffer
+ * 3) Sets errno to EAGAIN if there isn't enough data in the queue
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The source bit queue
+ * @param buffer The destintion buffer
+ * @param bit_count The amount of bits to peek
+ *
+ * @return int The number of bits peeked or -1 in failure
+ */
+int bit_queue_peek_bits(bit_queue_t *bq, uint8_t *buffer, size_t bit_count);
+
+/**
+ * @brief This function advances the read cursor without copying any data
+ *
+ * Used together with bit_queue_peek_bits or bit_queue_data_ptr to consume data that was decoded in place or to skip a payload.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bit_count = 0 or bq = NULL or bq->buffer = NULL
+ * 2) Sets errno to EMSGSIZE if the bit count is larger the the entire bit queue buffer
+ * 3) Sets errno to EAGAIN if there isn't enough data in the queue
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param bit_count The amount of bits to skip
+ *
+ * @return int The number of bits skipped or -1 in failure
+ */
+int bit_queue_advance_bits(bit_queue_t *bq, size_t bit_count);
+
+/**
+ * @brief This function exposes the contiguous byte aligned region of the bit queue buffer at the read cursor
+ *
+ * The region stays valid until the next read or write on the queue. The read cursor must be on a byte boundary.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or byte_count = NULL or bq->buffer = NULL or the read cursor is inside a byte
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param byte_count Out parameter that receives the amount of contiguous whole bytes of data at the returned address
+ *
+ * @return uint8_t* Address of the data at the read cursor or NULL in failure
+ */
+uint8_t * bit_queue_data_ptr(bit_queue_t *bq, size_t *byte_count);
+
+/**
+ * @brief The counters filled by bit_queue_get_stats
+ *
+ * The counters are only maintained when the library is compiled with -DBIT_QUEUE_STATS, otherwise
+ * bit_queue_get_stats fails with ENOTSUP. They are plain increments on branches the hot paths take anyway,
+ * so the instrumented build stays within a few percent of the stripped one.
+ */
+typedef struct
+{
+    uint64_t reads; /// Successful read family operations (read, readv, typed reads and unchecked reads)
+    uint64_t writes; /// Successful write family operations
+    uint64_t bits_read; /// Total bits moved out of the queue
+    uint64_t bits_written; /// Total bits moved into the queue
+    uint64_t aligned_ops; /// Operations that started on a byte boundary with a byte multiple width
+    uint64_t unaligned_ops; /// Operations that crossed bit offsets
+    uint64_t eagain; /// Operations refused for missing data or space
+    uint64_t emsgsize; /// Operations refused for exceeding the whole buffer
+    uint64_t refills; /// Refill callback invocations
+} bit_queue_stats_t;
+
+/**
+ * @brief This function copys the queue's counters into stats
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or stats = NULL
+ * 2) Sets errno to ENOTSUP when the library was built without BIT_QUEUE_STATS
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param stats Out parameter that receives the counters
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_get_stats(bit_queue_t *bq, bit_queue_stats_t *stats);
+
+/**
+ * @brief This function zeroes the queue's counters
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL
+ * 2) Sets errno to ENOTSUP when the library was built without BIT_QUEUE_STATS
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_reset_stats(bit_queue_t *bq);
+
+/**
+ * @brief A saved cursor state for speculative parsing, filled by bit_queue_mark
+ */
+typedef struct
+{
+    size_t head_bits; /// The saved write cursor
+    size_t tail_bits; /// The saved read cursor
+} bit_queue_mark_t;
+
+/**
+ * @brief This function saves the cursor state in O(1) for a later bit_queue_rewind
+ *
+ * Only the two cursors are saved, not the buffer, so a speculative parse can be rolled back without copying
+ * any data. Not meant for spsc queues where the other side keeps moving its cursor.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or mark = NULL
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param mark Out parameter that receives the cursor state
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_mark(bit_queue_t *bq, bit_queue_mark_t *mark);
+
+/**
+ * @brief This function restores the cursor state saved by bit_queue_mark in O(1)
+ *
+ * The rewind is refused when the marked data was allready overwritten, which happens once the writes since
+ * the mark moved more then a whole buffer past the marked read cursor.
+ *
+ * errno options:
+ * 1) Sets errno EINVAL if bq = NULL or mark = NULL or the mark does not belong to this queue's past or the
+ *    marked data was allready overwritten
+ *
+ * @ingroup bit_queue
+ *
+ * @param bq The bit queue
+ * @param mark The cursor state to restore
+ *
+ * @return int 0 in success or -1 in failure
+ */
+int bit_queue_rewind(bit_queue_t *bq, const bit_queue_mark_t *mark);
 
 /**
  * @brief Destroyes the bit queue and frees allocated data
@@ -0,0 +1,252 @@
+/**
+ * @file bit_queue.hpp
+ * @author amitfr1
+ * @brief This is a header only C++17 twin of the C bit queue for compile time known field widths
+ *
+ * The C api costs an opaque pointer call per field that the compiler can not inline or constant fold. This
+ * wrapper keeps the exact same buffer layout (lsb first bit order, monotonic cursors, ring position =
+ * cursor % capacity) but takes the capacity and the field widths as template parameters, so the shift and
+ * mask arithmetic specializes per width and the bound checks that are EMSGSIZE at runtime in bit_queue.c
+ * become static_asserts. A whole header decode compiles down to straight line loads and shifts.
+ *
+ * The queue is single threaded, the C library stays the home of the spsc and cross process modes.
+ */
+#ifndef BIT_QUEUE_HPP
+#define BIT_QUEUE_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+
+namespace bitq
+{
+
+namespace detail
+{
+
+/**
+ * @brief This alias picks the smallest unsigned type that holds Bits bits
+ */
+template <std::size_t Bits>
+using uint_for_bits =
+    std::conditional_t<Bits <= 8, std::uint8_t,
+    std::conditional_t<Bits <= 16, std::uint16_t,
+    std::conditional_t<Bits <= 32, std::uint32_t, std::uint64_t>>>;
+
+/**
+ * @brief This function loads a word from an unaligned address, the memcpy compiles to one mov
+ */
+inline std::uint64_t load_word(const std::uint8_t *p) noexcept
+{
+    std::uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+/**
+ * @brief This function stores a word to an unaligned address
+ */
+inline void store_word(std::uint8_t *p, std::uint64_t word) noexcept
+{
+    std::memcpy(p, &word, sizeof(word));
+}
+
+} // namespace detail
+
+/**
+ * @brief This class is a fixed capacity bit queue with per width specialized field access
+ *
+ * The read and write methods take the field width as a template parameter, so the mask is a constexpr and
+ * the width bound checks happen in the compiler instead of on the hot path. Availability (the EAGAIN class
+ * of failures in the C api) is still a runtime property and is reported with std::nullopt / false.
+ *
+ * @tparam CapacityBytes The buffer size in bytes
+ */
+template <std::size_t CapacityBytes>
+class bit_queue
+{
+    static_assert(CapacityBytes != 0, "a bit queue needs a buffer");
+
+public:
+    /// The buffer size in bits, the twin of capacity_bits in the C handle
+    static constexpr std::size_t capacity_bits = CapacityBytes * 8;
+
+    bit_queue() noexcept : buffer_{}, head_bits_(0), tail_bits_(0)
+    {
+    }
+
+    /**
+     * @brief This function reads a field of a compile time known width
+     *
+     * The first bit of the stream lands in bit 0 of the value, the same layout the C queue uses. The whole
+     * body folds to a load, a shift and a constexpr mask once Bits is known.
+     *
+     * @tparam Bits The field width, 1 to 64 and at most the capacity, checked at compile time
+     * @return std::optional holding the value, or std::nullopt when there isn't enough data in the queue
+     */
+    template <std::size_t Bits>
+    std::optional<detail::uint_for_bits<Bits>> read() noexcept
+    {
+        static_assert(Bits >= 1 && Bits <= 64, "a field is 1 to 64 bits");
+        static_assert(Bits <= capacity_bits, "the field is larger then the entire bit queue buffer");
+        std::optional<detail::uint_for_bits<Bits>> ret_val;
+        if (head_bits_ - tail_bits_ >= Bits)
+        {
+            ret_val = static_cast<detail::uint_for_bits<Bits>>(extract<Bits>(tail_bits_));
+            tail_bits_ += Bits;
+        }
+        return ret_val;
+    }
+
+    /**
+     * @brief This function peeks a field of a compile time known width without consuming it
+     *
+     * @tparam Bits The field width, 1 to 64 and at most the capacity, checked at compile time
+     * @return std::optional holding the value, or std::nullopt when there isn't enough data in the queue
+     */
+    template <std::size_t Bits>
+    std::optional<detail::uint_for_bits<Bits>> peek() const noexcept
+    {
+        static_assert(Bits >= 1 && Bits <= 64, "a field is 1 to 64 bits");
+        static_assert(Bits <= capacity_bits, "the field is larger then the entire bit queue buffer");
+        std::optional<detail::uint_for_bits<Bits>> ret_val;
+        if (head_bits_ - tail_bits_ >= Bits)
+        {
+            ret_val = static_cast<detail::uint_for_bits<Bits>>(extract<Bits>(tail_bits_));
+        }
+        return ret_val;
+    }
+
+    /**
+     * @brief This function writes a field of a compile time known width
+     *
+     * Bits past the field width are masked away, so the caller can hand a wider value without clearing it.
+     *
+     * @tparam Bits The field width, 1 to 64 and at most the capacity, checked at compile time
+     * @param value The field value, bit 0 becomes the first bit of the stream
+     * @return true in success or false when there isn't enough space in the queue
+     */
+    template <std::size_t Bits>
+    bool write(std::uint64_t value) noexcept
+    {
+        static_assert(Bits >= 1 && Bits <= 64, "a field is 1 to 64 bits");
+        static_assert(Bits <= capacity_bits, "the field is larger then the entire bit queue buffer");
+        bool ret_val = false;
+        if (capacity_bits - (head_bits_ - tail_bits_) >= Bits)
+        {
+            deposit<Bits>(head_bits_, value);
+            head_bits_ += Bits;
+            ret_val = true;
+        }
+        return ret_val;
+    }
+
+    /**
+     * @brief This function drops bit_count bits from the front of the queue
+     *
+     * @param bit_count The amount of bits to drop
+     * @return true in success or false when there isn't enough data in the queue
+     */
+    bool skip(std::size_t bit_count) noexcept
+    {
+        bool ret_val = false;
+        if (head_bits_ - tail_bits_ >= bit_count)
+        {
+            tail_bits_ += bit_count;
+            ret_val = true;
+        }
+        return ret_val;
+    }
+
+    /// The amount of queued bits
+    std::size_t size() const noexcept
+    {
+        return head_bits_ - tail_bits_;
+    }
+
+    /// The amount of free bits
+    std::size_t space() const noexcept
+    {
+        return capacity_bits - (head_bits_ - tail_bits_);
+    }
+
+private:
+    /**
+     * @brief This function extracts Bits bits at the given cursor, the twin of bit_queue_extract_value
+     *
+     * The common case is one word load, shift and constexpr mask. The branches below are on compile time
+     * and cursor alignment conditions only, near the buffer end or across the wrap it falls back to a byte
+     * loop exactly like the C kernel does.
+     */
+    template <std::size_t Bits>
+    std::uint64_t extract(std::size_t cursor) const noexcept
+    {
+        constexpr std::uint64_t mask = (Bits == 64) ? ~0ull : ((1ull << Bits) - 1);
+        std::size_t pos = cursor % capacity_bits;
+        std::size_t byte = pos / 8;
+        std::size_t off = pos % 8;
+        std::uint64_t value;
+        if (byte + sizeof(std::uint64_t) <= CapacityBytes && off + Bits <= 64)
+        {
+            value = detail::load_word(buffer_.data() + byte) >> off;
+        }
+        else
+        {
+            // the span touches the buffer end or wraps, gather it a bit at a time
+            value = 0;
+            for (std::size_t i = 0; i < Bits; i++)
+            {
+                std::size_t bit = (pos + i) % capacity_bits;
+                value |= static_cast<std::uint64_t>((buffer_[bit / 8] >> (bit % 8)) & 1u) << i;
+            }
+        }
+        return value & mask;
+    }
+
+    /**
+     * @brief This function deposits Bits bits at the given cursor, the write side twin of extract
+     */
+    template <std::size_t Bits>
+    void deposit(std::size_t cursor, std::uint64_t value) noexcept
+    {
+        constexpr std::uint64_t mask = (Bits == 64) ? ~0ull : ((1ull << Bits) - 1);
+        std::size_t pos = cursor % capacity_bits;
+        std::size_t byte = pos / 8;
+        std::size_t off = pos % 8;
+        value &= mask;
+        if (byte + sizeof(std::uint64_t) <= CapacityBytes && off + Bits <= 64)
+        {
+            // one read modify write of a word, the surrounding bits are kept
+            std::uint64_t word = detail::load_word(buffer_.data() + byte);
+            word = (word & ~(mask << off)) | (value << off);
+            detail::store_word(buffer_.data() + byte, word);
+        }
+        else
+        {
+            for (std::size_t i = 0; i < Bits; i++)
+            {
+                std::size_t bit = (pos + i) % capacity_bits;
+                std::uint8_t bit_mask = static_cast<std::uint8_t>(1u << (bit % 8));
+                if ((value >> i) & 1u)
+                {
+                    buffer_[bit / 8] = static_cast<std::uint8_t>(buffer_[bit / 8] | bit_mask);
+                }
+                else
+                {
+                    buffer_[bit / 8] = static_cast<std::uint8_t>(buffer_[bit / 8] & ~bit_mask);
+                }
+            }
+        }
+    }
+
+    std::array<std::uint8_t, CapacityBytes> buffer_; /// The buffer that holds all of the data
+    std::size_t head_bits_; /// The total amount of bits ever written
+    std::size_t tail_bits_; /// The total amount of bits ever read
+};
+
+} // namespace bitq
+
+#endif // BIT_QUEUE_HPP
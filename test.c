@@ -6,15 +6,35 @@ int main()
     bit_queue_t * bq;
     uint16_t buffer = 0xaaaa;
     uint16_t res;
+    int failed = 0;
     bq = bit_queue_init((uint8_t*)&buffer, 2, false);
     bit_queue_read_bits(bq, (uint8_t*)&res, 8);
     printf("m1 = %d\n", res);
+    failed += (res != 0xaa);
     res = 0;
     bit_queue_read_bits(bq, (uint8_t*)&res, 5);
     printf("m2 = %d\n", res);
+    failed += (res != 0x0a);
     res = 0;
     bit_queue_read_bits(bq, (uint8_t*)&res, 1);
     printf("m3 = %d\n", res);
+    failed += (res != 1);
     bit_queue_destroy(bq);
-    return 0;
+    /* write then read back an unaligned span, lapping the ring so the wrap path is covered too */
+    uint8_t in[3] = {0x5b, 0xc4, 0x2e};
+    uint8_t out[3];
+    int lap;
+    int mismatch = 0;
+    bq = bit_queue_base_init(4);
+    for (lap = 0; lap < 10; lap++)
+    {
+        out[0] = out[1] = out[2] = 0;
+        mismatch += (bit_queue_write_bits(bq, in, 21) != 21);
+        mismatch += (bit_queue_read_bits(bq, out, 21) != 21);
+        mismatch += (out[0] != in[0]) || (out[1] != in[1]) || ((out[2] & 0x1f) != (in[2] & 0x1f));
+    }
+    printf("m4 = %d\n", mismatch);
+    failed += (mismatch != 0);
+    bit_queue_destroy(bq);
+    return failed;
 }
\ No newline at end of file